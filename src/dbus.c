@@ -13,6 +13,7 @@
 
 #include "dbus.h"
 #include "draw.h"
+#include "icon.h"
 #include "dunst.h"
 #include "log.h"
 #include "menu.h"
@@ -93,6 +94,10 @@ static const char *introspection_xml =
     "        <method name=\"NotificationPopHistory\">"
     "            <arg direction=\"in\"  name=\"id\"              type=\"u\"/>"
     "        </method>"
+    "        <method name=\"NotificationQueryHistory\">"
+    "            <arg direction=\"in\"  name=\"query\"           type=\"a{sv}\"/>"
+    "            <arg direction=\"out\" name=\"notifications\"   type=\"aa{sv}\"/>"
+    "        </method>"
     "        <method name=\"NotificationRemoveFromHistory\">"
     "            <arg direction=\"in\"  name=\"id\"              type=\"u\"/>"
     "        </method>"
@@ -128,6 +133,25 @@ static const char *introspection_xml =
     "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"true\"/>"
     "        </property>"
 
+    "        <property name=\"iconCacheHits\" type=\"t\" access=\"read\">"
+    "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"false\"/>"
+    "        </property>"
+    "        <property name=\"iconCacheMisses\" type=\"t\" access=\"read\">"
+    "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"false\"/>"
+    "        </property>"
+    "        <property name=\"iconCacheSize\" type=\"t\" access=\"read\">"
+    "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"false\"/>"
+    "        </property>"
+    "        <property name=\"wakeUpsCoalesced\" type=\"u\" access=\"read\">"
+    "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"false\"/>"
+    "        </property>"
+    "        <property name=\"redrawsDrawn\" type=\"u\" access=\"read\">"
+    "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"false\"/>"
+    "        </property>"
+    "        <property name=\"redrawsSkipped\" type=\"u\" access=\"read\">"
+    "            <annotation name=\"org.freedesktop.DBus.Property.EmitsChangedSignal\" value=\"false\"/>"
+    "        </property>"
+
 
     "        <signal name=\"NotificationHistoryRemoved\">"
     "            <arg name=\"id\"         type=\"u\"/>"
@@ -215,6 +239,7 @@ DBUS_METHOD(dunst_NotificationCloseAll);
 DBUS_METHOD(dunst_NotificationCloseLast);
 DBUS_METHOD(dunst_NotificationListHistory);
 DBUS_METHOD(dunst_NotificationPopHistory);
+DBUS_METHOD(dunst_NotificationQueryHistory);
 DBUS_METHOD(dunst_NotificationRemoveFromHistory);
 DBUS_METHOD(dunst_NotificationShow);
 DBUS_METHOD(dunst_RuleEnable);
@@ -232,6 +257,7 @@ static struct dbus_method methods_dunst[] = {
         {"NotificationCloseLast",               dbus_cb_dunst_NotificationCloseLast},
         {"NotificationListHistory",             dbus_cb_dunst_NotificationListHistory},
         {"NotificationPopHistory",              dbus_cb_dunst_NotificationPopHistory},
+        {"NotificationQueryHistory",            dbus_cb_dunst_NotificationQueryHistory},
         {"NotificationRemoveFromHistory",       dbus_cb_dunst_NotificationRemoveFromHistory},
         {"NotificationShow",                    dbus_cb_dunst_NotificationShow},
         {"Ping",                                dbus_cb_dunst_Ping},
@@ -362,6 +388,109 @@ static void dbus_cb_dunst_NotificationShow(GDBusConnection *connection,
         g_dbus_connection_flush(connection, NULL, NULL, NULL);
 }
 
+/**
+ * The fields of a notification exported by the history methods
+ */
+enum history_field {
+        HISTORY_FIELD_BODY,
+        HISTORY_FIELD_MESSAGE,
+        HISTORY_FIELD_SUMMARY,
+        HISTORY_FIELD_APPNAME,
+        HISTORY_FIELD_CATEGORY,
+        HISTORY_FIELD_DEFAULT_ACTION_NAME,
+        HISTORY_FIELD_ICON_PATH,
+        HISTORY_FIELD_ID,
+        HISTORY_FIELD_TIMESTAMP,
+        HISTORY_FIELD_TIMEOUT,
+        HISTORY_FIELD_PROGRESS,
+        HISTORY_FIELD_URGENCY,
+        HISTORY_FIELD_STACK_TAG,
+        HISTORY_FIELD_URLS,
+        HISTORY_FIELD_COUNT,
+};
+
+#define HISTORY_FIELDS_ALL ((1u << HISTORY_FIELD_COUNT) - 1)
+
+static const char *history_field_names[HISTORY_FIELD_COUNT] = {
+        [HISTORY_FIELD_BODY]                = "body",
+        [HISTORY_FIELD_MESSAGE]             = "message",
+        [HISTORY_FIELD_SUMMARY]             = "summary",
+        [HISTORY_FIELD_APPNAME]             = "appname",
+        [HISTORY_FIELD_CATEGORY]            = "category",
+        [HISTORY_FIELD_DEFAULT_ACTION_NAME] = "default_action_name",
+        [HISTORY_FIELD_ICON_PATH]           = "icon_path",
+        [HISTORY_FIELD_ID]                  = "id",
+        [HISTORY_FIELD_TIMESTAMP]           = "timestamp",
+        [HISTORY_FIELD_TIMEOUT]             = "timeout",
+        [HISTORY_FIELD_PROGRESS]            = "progress",
+        [HISTORY_FIELD_URGENCY]             = "urgency",
+        [HISTORY_FIELD_STACK_TAG]           = "stack_tag",
+        [HISTORY_FIELD_URLS]                = "urls",
+};
+
+static const char *history_str(const char *str)
+{
+        return str ? str : "";
+}
+
+static GVariant *history_field_value(const struct notification *n, enum history_field field)
+{
+        switch (field) {
+        case HISTORY_FIELD_BODY:
+                return g_variant_new_string(history_str(n->body));
+        case HISTORY_FIELD_MESSAGE:
+                return g_variant_new_string(history_str(n->msg));
+        case HISTORY_FIELD_SUMMARY:
+                return g_variant_new_string(history_str(n->summary));
+        case HISTORY_FIELD_APPNAME:
+                return g_variant_new_string(history_str(n->appname));
+        case HISTORY_FIELD_CATEGORY:
+                return g_variant_new_string(history_str(n->category));
+        case HISTORY_FIELD_DEFAULT_ACTION_NAME:
+                return g_variant_new_string(history_str(n->default_action_name));
+        case HISTORY_FIELD_ICON_PATH:
+                return g_variant_new_string(history_str(n->icon_path));
+        case HISTORY_FIELD_ID:
+                return g_variant_new_int32(n->id);
+        case HISTORY_FIELD_TIMESTAMP:
+                return g_variant_new_int64(n->timestamp);
+        case HISTORY_FIELD_TIMEOUT:
+                return g_variant_new_int64(n->timeout);
+        case HISTORY_FIELD_PROGRESS:
+                return g_variant_new_int32(n->progress);
+        case HISTORY_FIELD_URGENCY:
+                return g_variant_new_string(notification_urgency_to_string(n->urgency));
+        case HISTORY_FIELD_STACK_TAG:
+                return g_variant_new_string(history_str(n->stack_tag));
+        case HISTORY_FIELD_URLS:
+                return g_variant_new_string(history_str(n->urls));
+        default:
+                return NULL;
+        }
+}
+
+/**
+ * Add a notification to an aa{sv} builder
+ *
+ * @param builder The builder of the notifications array
+ * @param n The notification to add
+ * @param fields Bitmask of the #history_field values to include
+ */
+static void history_builder_add(GVariantBuilder *builder, const struct notification *n, guint fields)
+{
+        GVariantBuilder n_builder;
+        g_variant_builder_init(&n_builder, G_VARIANT_TYPE("a{sv}"));
+
+        for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+                if (fields & (1u << i))
+                        g_variant_builder_add(&n_builder, "{sv}",
+                                              history_field_names[i],
+                                              history_field_value(n, i));
+        }
+
+        g_variant_builder_add(builder, "a{sv}", &n_builder);
+}
+
 static void dbus_cb_dunst_NotificationListHistory(GDBusConnection *connection,
                                            const gchar *sender,
                                            GVariant *parameters,
@@ -372,52 +501,129 @@ static void dbus_cb_dunst_NotificationListHistory(GDBusConnection *connection,
         GVariantBuilder builder;
         g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
 
-        GList *notification_list = queues_get_history();
-
         // reverse chronological list
-        for(int i = queues_length_history(); i > 0; i--) {
-                struct notification *n;
-                n = g_list_nth_data(notification_list, i-1);
-
-                GVariantBuilder n_builder;
-                g_variant_builder_init(&n_builder, G_VARIANT_TYPE("a{sv}"));
-
-                char *body, *msg, *summary, *appname, *category;
-                char *default_action_name, *icon_path;
-                char  *urls, *stack_tag;
-                const char *urgency;
-
-                body      = (n->body      == NULL) ? "" : n->body;
-                msg       = (n->msg       == NULL) ? "" : n->msg;
-                summary   = (n->summary   == NULL) ? "" : n->summary;
-                appname   = (n->appname   == NULL) ? "" : n->appname;
-                category  = (n->category  == NULL) ? "" : n->category;
-                default_action_name= (n->default_action_name == NULL) ?
-                        "" : n->default_action_name;
-                icon_path = (n->icon_path == NULL) ? "" : n->icon_path;
-                urgency   = notification_urgency_to_string(n->urgency);
-                urls      = (n->urls      == NULL) ? "" : n->urls;
-                stack_tag = (n->stack_tag == NULL) ? "" : n->stack_tag;
-
-                g_variant_builder_add(&n_builder, "{sv}", "body", g_variant_new_string(body));
-                g_variant_builder_add(&n_builder, "{sv}", "message", g_variant_new_string(msg));
-                g_variant_builder_add(&n_builder, "{sv}", "summary", g_variant_new_string(summary));
-                g_variant_builder_add(&n_builder, "{sv}", "appname", g_variant_new_string(appname));
-                g_variant_builder_add(&n_builder, "{sv}", "category", g_variant_new_string(category));
-                g_variant_builder_add(&n_builder, "{sv}", "default_action_name",
-                        g_variant_new_string(default_action_name));
-                g_variant_builder_add(&n_builder, "{sv}", "icon_path", g_variant_new_string(icon_path));
-                g_variant_builder_add(&n_builder, "{sv}", "id", g_variant_new_int32(n->id));
-                g_variant_builder_add(&n_builder, "{sv}", "timestamp", g_variant_new_int64(n->timestamp));
-                g_variant_builder_add(&n_builder, "{sv}", "timeout", g_variant_new_int64(n->timeout));
-                g_variant_builder_add(&n_builder, "{sv}", "progress", g_variant_new_int32(n->progress));
-                g_variant_builder_add(&n_builder, "{sv}", "urgency", g_variant_new_string(urgency));
-                g_variant_builder_add(&n_builder, "{sv}", "stack_tag", g_variant_new_string(stack_tag));
-                g_variant_builder_add(&n_builder, "{sv}", "urls", g_variant_new_string(urls));
-
-                g_variant_builder_add(&builder, "a{sv}", &n_builder);
+        for (const GList *iter = queues_get_history_last(); iter; iter = iter->prev)
+                history_builder_add(&builder, iter->data, HISTORY_FIELDS_ALL);
+
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(aa{sv})", &builder));
+        g_dbus_connection_flush(connection, NULL, NULL, NULL);
+}
+
+/**
+ * The options of NotificationQueryHistory and their expected types
+ */
+static const struct {
+        const char *key;
+        const char *type;
+} history_query_options[] = {
+        { "offset",  "u"  },
+        { "limit",   "u"  },
+        { "since",   "x"  },
+        { "appname", "s"  },
+        { "urgency", "s"  },
+        { "fields",  "as" },
+};
+
+static void dbus_cb_dunst_NotificationQueryHistory(GDBusConnection *connection,
+                                                   const gchar *sender,
+                                                   GVariant *parameters,
+                                                   GDBusMethodInvocation *invocation)
+{
+        LOG_D("CMD: Querying notifications from history");
+
+        GVariant *query = g_variant_get_child_value(parameters, 0);
+        GVariantDict d;
+        g_variant_dict_init(&d, query);
+        g_variant_unref(query);
+
+        char *error = NULL;
+
+        // The lookups below silently skip values of the wrong type
+        for (size_t i = 0; i < G_N_ELEMENTS(history_query_options) && !error; i++) {
+                const char *type = history_query_options[i].type;
+                GVariant *value = g_variant_dict_lookup_value(&d, history_query_options[i].key, NULL);
+                if (!value)
+                        continue;
+
+                if (!g_variant_is_of_type(value, G_VARIANT_TYPE(type)))
+                        error = g_strdup_printf("Option \"%s\" must be of type '%s', not '%s'",
+                                                history_query_options[i].key, type,
+                                                g_variant_get_type_string(value));
+                g_variant_unref(value);
+        }
+
+        guint32 offset = 0, limit = 0;
+        gint64 since = 0;
+        char *appname = NULL, *urgency = NULL;
+        char **fields = NULL;
+        g_variant_dict_lookup(&d, "offset", "u", &offset);
+        g_variant_dict_lookup(&d, "limit", "u", &limit);
+        g_variant_dict_lookup(&d, "since", "x", &since);
+        g_variant_dict_lookup(&d, "appname", "s", &appname);
+        g_variant_dict_lookup(&d, "urgency", "s", &urgency);
+        g_variant_dict_lookup(&d, "fields", "^as", &fields);
+        g_variant_dict_clear(&d);
+
+        int urg = URG_NONE;
+        if (!error && urgency && !string_parse_enum(urgency_enum_data, urgency, &urg))
+                error = g_strdup_printf("Unknown urgency \"%s\"", urgency);
+
+        guint mask = fields ? 0 : HISTORY_FIELDS_ALL;
+        for (int i = 0; fields && fields[i] && !error; i++) {
+                int field = 0;
+                while (field < HISTORY_FIELD_COUNT && !STR_EQ(fields[i], history_field_names[field]))
+                        field++;
+
+                if (field == HISTORY_FIELD_COUNT)
+                        error = g_strdup_printf("Unknown field \"%s\"", fields[i]);
+                else
+                        mask |= 1u << field;
         }
 
+        if (error) {
+                g_dbus_method_invocation_return_error(invocation,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_INVALID_ARGS,
+                        "%s", error);
+                g_free(error);
+                g_free(appname);
+                g_free(urgency);
+                g_strfreev(fields);
+                return;
+        }
+
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+
+        // reverse chronological list, skipping the first offset matches
+        guint32 added = 0;
+        for (const GList *iter = queues_get_history_last();
+             iter && (limit == 0 || added < limit);
+             iter = iter->prev) {
+                const struct notification *n = iter->data;
+
+                // Arrival precedes the push, so everything older arrived before since
+                if (n->history_time < since)
+                        break;
+
+                if (n->timestamp < since
+                    || (appname && !STR_EQ(appname, history_str(n->appname)))
+                    || (urgency && n->urgency != (enum urgency) urg))
+                        continue;
+
+                if (offset > 0) {
+                        offset--;
+                        continue;
+                }
+
+                history_builder_add(&builder, n, mask);
+                added++;
+        }
+
+        g_free(appname);
+        g_free(urgency);
+        g_strfreev(fields);
+
         g_dbus_method_invocation_return_value(invocation, g_variant_new("(aa{sv})", &builder));
         g_dbus_connection_flush(connection, NULL, NULL, NULL);
 }
@@ -1210,6 +1416,24 @@ GVariant *dbus_cb_dunst_Properties_Get(GDBusConnection *connection,
         } else if (STR_EQ(property_name, "waitingLength")) {
                 unsigned int waiting =  queues_length_waiting();
                 return g_variant_new_uint32(waiting);
+        } else if (STR_EQ(property_name, "iconCacheHits")) {
+                struct icon_cache_stats stats;
+                icon_cache_get_stats(&stats);
+                return g_variant_new_uint64(stats.hits);
+        } else if (STR_EQ(property_name, "iconCacheMisses")) {
+                struct icon_cache_stats stats;
+                icon_cache_get_stats(&stats);
+                return g_variant_new_uint64(stats.misses);
+        } else if (STR_EQ(property_name, "iconCacheSize")) {
+                struct icon_cache_stats stats;
+                icon_cache_get_stats(&stats);
+                return g_variant_new_uint64(stats.size);
+        } else if (STR_EQ(property_name, "wakeUpsCoalesced")) {
+                return g_variant_new_uint32(wake_ups_coalesced());
+        } else if (STR_EQ(property_name, "redrawsDrawn")) {
+                return g_variant_new_uint32(redraws_drawn());
+        } else if (STR_EQ(property_name, "redrawsSkipped")) {
+                return g_variant_new_uint32(redraws_skipped());
         } else {
                 LOG_W("Unknown property!\n");
                 *error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "Unknown property");
@@ -13,6 +13,7 @@
 #include <pango/pango-layout.h>
 #include <pango/pango-types.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <glib.h>
 
@@ -29,7 +30,9 @@
 #include "icon-lookup.h"
 
 struct colored_layout {
-        PangoLayout *l;
+        PangoLayout *l;       /**< Laid out at the final width, to render */
+        PangoLayout *measure; /**< Laid out at the maximum width, to calculate the dimensions */
+        PangoLayout *age;     /**< The age of the notification, shown after the text */
         char *text;
         PangoAttrList *attr;
         cairo_surface_t *icon;
@@ -37,6 +40,58 @@ struct colored_layout {
         bool is_xmore;
 };
 
+/**
+ * The layouts of a notification, kept between draws. Pango only shapes
+ * the text again when the properties set on a layout change, so the
+ * layouts for measuring and rendering are kept apart.
+ */
+struct layout_cache {
+        char *markup;         /**< The text_to_render the layouts were created from */
+        char *text;
+        PangoAttrList *attr;
+        PangoLayout *render;
+        PangoLayout *measure;
+        PangoLayout *age;     /**< Separate, so the ticking age does not reshape the text */
+        char *age_text;
+        double dpi;
+        double scale;
+        unsigned int generation;
+};
+
+/** Incremented when the font or other settings of all layouts change */
+static unsigned int layout_generation = 0;
+
+/**
+ * A notification as it got painted into a frame
+ */
+struct draw_band {
+        int y1, y2;   /**< The vertical extent in unscaled pixels */
+        guint hash;   /**< Of everything painting the notification depends on */
+};
+
+/**
+ * The contents of a surface notifications got rendered into. The output may
+ * hand out several buffers in turn, so each one remembers what it holds.
+ */
+struct draw_frame {
+        cairo_surface_t *srf;
+        bool owned;   /**< Created by draw() itself, as the output has no buffer to render into */
+        int w, h;
+        int corner_radius;
+        double scale;
+        unsigned int generation;
+        GArray *bands; /**< The struct draw_band of the notifications from top to bottom */
+        guint64 used;
+};
+
+#define DRAW_FRAMES 4
+
+static struct {
+        struct draw_frame frames[DRAW_FRAMES];
+        struct draw_frame *last; /**< The frame shown last */
+        guint64 count;
+} frames;
+
 const struct output *output;
 window win;
 
@@ -160,6 +215,7 @@ void draw_setup(void)
         LOG_D("Trying to load font: '%s'", settings.font);
         pango_fdesc = pango_font_description_from_string(settings.font);
         LOG_D("Loaded closest matching font: '%s'", pango_font_description_get_family(pango_fdesc));
+        layout_generation++;
 
         if (settings.enable_recursive_icon_lookup)
                 load_icon_themes();
@@ -249,6 +305,76 @@ static void get_text_size(PangoLayout *l, int *w, int *h, double scale) {
                 *h = ceil(*h / scale);
 }
 
+/**
+ * Get the position of the age relative to the text, in Pango units.
+ *
+ * The age follows the last line of the text, as if it was part of it. It
+ * only gets placed on a line of its own when it does not fit there, which
+ * is where wrapping the text would have moved it as well.
+ *
+ * @param l The layout of the text, cl->l or cl->measure
+ */
+static void get_age_position(const struct colored_layout *cl, PangoLayout *l, int *x, int *y)
+{
+        int width = pango_layout_get_width(l);
+        int age_w;
+        pango_layout_get_size(cl->age, &age_w, NULL);
+
+        *y = 0;
+        if (STR_FULL(pango_layout_get_text(l))) {
+                PangoLayoutIter *iter = pango_layout_get_iter(l);
+                while (pango_layout_iter_next_line(iter));
+
+                PangoRectangle line;
+                pango_layout_iter_get_line_extents(iter, NULL, &line);
+                int baseline = pango_layout_iter_get_baseline(iter);
+                pango_layout_iter_free(iter);
+
+                if (width < 0 || line.x + line.width + age_w <= width) {
+                        *x = line.x + line.width;
+                        *y = baseline - pango_layout_get_baseline(cl->age);
+                        return;
+                }
+
+                *y = line.y + line.height;
+        }
+
+        switch (pango_layout_get_alignment(l)) {
+        case PANGO_ALIGN_CENTER:
+                *x = MAX(0, width - age_w) / 2;
+                break;
+        case PANGO_ALIGN_RIGHT:
+                *x = MAX(0, width - age_w);
+                break;
+        default:
+                *x = 0;
+                break;
+        }
+}
+
+/**
+ * Get the size of the text together with the age after it
+ *
+ * @param l The layout of the text, cl->l or cl->measure
+ */
+static void get_layout_text_size(const struct colored_layout *cl, PangoLayout *l, int *w, int *h, double scale)
+{
+        if (!cl->age) {
+                get_text_size(l, w, h, scale);
+                return;
+        }
+
+        int text_w, text_h, age_x, age_y, age_w, age_h;
+        pango_layout_get_size(l, &text_w, &text_h);
+        pango_layout_get_size(cl->age, &age_w, &age_h);
+        get_age_position(cl, l, &age_x, &age_y);
+
+        if (w)
+                *w = ceil(PANGO_PIXELS_CEIL(MAX(text_w, age_x + age_w)) / scale);
+        if (h)
+                *h = ceil(PANGO_PIXELS_CEIL(MAX(text_h, age_y + age_h)) / scale);
+}
+
 // Set up pango for a given layout.
 // @param width The avaiable text width in pixels, used for caluclating alignment and wrapping
 // @param height The maximum text height in pixels.
@@ -273,32 +399,55 @@ static void layout_setup_pango(PangoLayout *layout, int width, int height,
 }
 
 // Set up the layout of a single notification
+// @param l The layout of the text to set up, cl->l or cl->measure
 // @param width Width of the layout
 // @param height Height of the layout
-static void layout_setup(struct colored_layout *cl, int width, int height, double scale)
+static void layout_setup(struct colored_layout *cl, PangoLayout *l, int width, int height, double scale)
 {
         int horizontal_padding = get_horizontal_text_icon_padding(cl->n);
         int icon_width = cl->icon ? get_icon_width(cl->icon, scale) + horizontal_padding : 0;
         int text_width = width - 2 * settings.h_padding - (cl->n->icon_position == ICON_TOP ? 0 : icon_width);
         int progress_bar_height = have_progress_bar(cl) ? settings.progress_bar_height + settings.padding : 0;
         int max_text_height = MAX(0, settings.height.max - progress_bar_height - 2 * settings.padding);
-        layout_setup_pango(cl->l, text_width, max_text_height, cl->n->word_wrap, cl->n->ellipsize, cl->n->alignment);
+        layout_setup_pango(l, text_width, max_text_height, cl->n->word_wrap, cl->n->ellipsize, cl->n->alignment);
+        // The age is placed by get_age_position(), so it has no width to align in
+        if (cl->age)
+                pango_layout_set_font_description(cl->age, pango_fdesc);
 }
 
 static void free_colored_layout(void *data)
 {
         struct colored_layout *cl = data;
         g_object_unref(cl->l);
+        g_object_unref(cl->measure);
+        if (cl->age)
+                g_object_unref(cl->age);
         pango_attr_list_unref(cl->attr);
         g_free(cl->text);
         g_free(cl);
 }
 
+void draw_layout_cache_free(struct layout_cache *cache)
+{
+        if (!cache)
+                return;
+
+        g_object_unref(cache->render);
+        g_object_unref(cache->measure);
+        if (cache->age)
+                g_object_unref(cache->age);
+        pango_attr_list_unref(cache->attr);
+        g_free(cache->markup);
+        g_free(cache->text);
+        g_free(cache->age_text);
+        g_free(cache);
+}
+
 // calculates the minimum dimensions of the notification excluding the frame
 static struct dimensions calculate_notification_dimensions(struct colored_layout *cl, double scale)
 {
         struct dimensions dim = { 0 };
-        layout_setup(cl, settings.width.max, settings.height.max, scale);
+        layout_setup(cl, cl->measure, settings.width.max, settings.height.max, scale);
 
         int horizontal_padding = get_horizontal_text_icon_padding(cl->n);
         int icon_width = cl->icon? get_icon_width(cl->icon, scale) + horizontal_padding : 0;
@@ -311,7 +460,7 @@ static struct dimensions calculate_notification_dimensions(struct colored_layout
                 dim.text_width = 0;
                 dim.text_height = 0;
         } else {
-                get_text_size(cl->l, &dim.text_width, &dim.text_height, scale);
+                get_layout_text_size(cl, cl->measure, &dim.text_width, &dim.text_height, scale);
                 vertical_padding = get_vertical_text_icon_padding(cl->n);
         }
 
@@ -390,12 +539,12 @@ static PangoLayout *layout_create(cairo_t *c)
         return layout;
 }
 
-static struct colored_layout *layout_init_shared(cairo_t *c, struct notification *n)
+static struct colored_layout *layout_init_shared(struct notification *n)
 {
         struct colored_layout *cl = g_malloc(sizeof(struct colored_layout));
-        cl->l = layout_create(c);
         cl->is_xmore = false;
         cl->n = n;
+        cl->age = NULL;
 
         // Invalid colors should never reach this point!
         assert(settings.frame_width == 0 || COLOR_VALID(COLOR(cl, frame)));
@@ -407,7 +556,9 @@ static struct colored_layout *layout_init_shared(cairo_t *c, struct notification
 
 static struct colored_layout *layout_derive_xmore(cairo_t *c, struct notification *n, int qlen)
 {
-        struct colored_layout *cl = layout_init_shared(c, n);
+        struct colored_layout *cl = layout_init_shared(n);
+        cl->l = layout_create(c);
+        cl->measure = g_object_ref(cl->l);
         cl->text = g_strdup_printf("(%d more)", qlen);
         cl->attr = NULL;
         cl->is_xmore = true;
@@ -416,38 +567,87 @@ static struct colored_layout *layout_derive_xmore(cairo_t *c, struct notificatio
         return cl;
 }
 
-static struct colored_layout *layout_from_notification(cairo_t *c, struct notification *n)
+/**
+ * Create the layouts of the text of the notification
+ */
+static struct layout_cache *layout_cache_new(cairo_t *c, struct notification *n)
 {
-
-        struct colored_layout *cl = layout_init_shared(c, n);
-
-        if (n->icon_position != ICON_OFF && n->icon) {
-                cl->icon = n->icon;
-        } else {
-                cl->icon = NULL;
-        }
+        struct layout_cache *cache = g_malloc0(sizeof(struct layout_cache));
+        cache->markup = g_strdup(n->text_to_render);
+        cache->dpi = output->get_active_screen()->dpi;
+        cache->scale = output->get_scale();
+        cache->generation = layout_generation;
+        cache->render = layout_create(c);
 
         /* markup */
         GError *err = NULL;
-        pango_parse_markup(n->text_to_render, -1, 0, &(cl->attr), &(cl->text), NULL, &err);
+        pango_parse_markup(n->text_to_render, -1, 0, &(cache->attr), &(cache->text), NULL, &err);
 
         if (!err) {
-                pango_layout_set_text(cl->l, cl->text, -1);
-                pango_attr_list_insert(cl->attr, pango_attr_fallback_new(true));
-                pango_layout_set_attributes(cl->l, cl->attr);
+                pango_layout_set_text(cache->render, cache->text, -1);
+                pango_attr_list_insert(cache->attr, pango_attr_fallback_new(true));
+                pango_layout_set_attributes(cache->render, cache->attr);
         } else {
                 /* remove markup and display plain message instead */
                 n->text_to_render = markup_strip(n->text_to_render);
-                cl->text = NULL;
-                cl->attr = pango_attr_list_new();
-                pango_attr_list_insert(cl->attr, pango_attr_fallback_new(true));
-                pango_layout_set_text(cl->l, n->text_to_render, -1);
+                cache->text = NULL;
+                cache->attr = pango_attr_list_new();
+                pango_attr_list_insert(cache->attr, pango_attr_fallback_new(true));
+                pango_layout_set_text(cache->render, n->text_to_render, -1);
                 if (n->first_render) {
                         LOG_W("Unable to parse markup: %s", err->message);
                 }
                 g_error_free(err);
         }
 
+        // Shares the context, text and attributes, but gets laid out separately
+        cache->measure = pango_layout_copy(cache->render);
+        return cache;
+}
+
+static struct colored_layout *layout_from_notification(cairo_t *c, struct notification *n)
+{
+
+        struct colored_layout *cl = layout_init_shared(n);
+
+        if (n->icon_position != ICON_OFF && n->icon) {
+                cl->icon = n->icon;
+        } else {
+                cl->icon = NULL;
+        }
+
+        struct layout_cache *cache = n->layout_cache;
+        if (cache && (!STR_EQ(cache->markup, n->text_to_render)
+                      || cache->dpi != output->get_active_screen()->dpi
+                      || cache->scale != output->get_scale()
+                      || cache->generation != layout_generation))
+                g_clear_pointer(&n->layout_cache, draw_layout_cache_free);
+
+        if (!n->layout_cache)
+                n->layout_cache = layout_cache_new(c, n);
+        cache = n->layout_cache;
+
+        if (n->age_to_render) {
+                if (!cache->age) {
+                        cache->age = pango_layout_new(pango_layout_get_context(cache->render));
+                        PangoAttrList *attr = pango_attr_list_new();
+                        pango_attr_list_insert(attr, pango_attr_fallback_new(true));
+                        pango_layout_set_attributes(cache->age, attr);
+                        pango_attr_list_unref(attr);
+                }
+                if (!STR_EQ(cache->age_text, n->age_to_render)) {
+                        g_free(cache->age_text);
+                        cache->age_text = g_strdup(n->age_to_render);
+                        pango_layout_set_text(cache->age, cache->age_text, -1);
+                }
+                cl->age = g_object_ref(cache->age);
+        }
+
+        cl->l = g_object_ref(cache->render);
+        cl->measure = g_object_ref(cache->measure);
+        cl->text = NULL;
+        cl->attr = NULL;
+
         n->first_render = false;
         return cl;
 }
@@ -495,7 +695,7 @@ static int layout_get_height(struct colored_layout *cl, double scale)
         if (cl->n->hide_text) {
                 vertical_padding = 0;
         } else {
-                get_text_size(cl->l, NULL, &h_text, scale);
+                get_layout_text_size(cl, cl->measure, NULL, &h_text, scale);
                 vertical_padding = get_vertical_text_icon_padding(cl->n);
         }
 
@@ -787,7 +987,7 @@ static void render_content(cairo_t *c, struct colored_layout *cl, int width, int
 {
         // Redo layout setup, while knowing the width. This is to make
         // alignment work correctly
-        layout_setup(cl, width, height, scale);
+        layout_setup(cl, cl->l, width, height, scale);
 
         // NOTE: Includes paddings!
         int h_without_progress_bar = height;
@@ -797,7 +997,7 @@ static void render_content(cairo_t *c, struct colored_layout *cl, int width, int
 
         int text_h = 0;
         if (!cl->n->hide_text) {
-                get_text_size(cl->l, NULL, &text_h, scale);
+                get_layout_text_size(cl, cl->l, NULL, &text_h, scale);
         }
 
         // text vertical alignment
@@ -862,8 +1062,19 @@ static void render_content(cairo_t *c, struct colored_layout *cl, int width, int
         if (!cl->n->hide_text) {
                 cairo_move_to(c, round(text_x * scale), round(text_y * scale));
                 cairo_set_source_rgba(c, COLOR(cl, fg.r), COLOR(cl, fg.g), COLOR(cl, fg.b), COLOR(cl, fg.a));
-                pango_cairo_update_layout(c, cl->l);
-                pango_cairo_show_layout(c, cl->l);
+                if (STR_FULL(pango_layout_get_text(cl->l))) {
+                        pango_cairo_update_layout(c, cl->l);
+                        pango_cairo_show_layout(c, cl->l);
+                }
+
+                if (cl->age) {
+                        int age_x, age_y;
+                        get_age_position(cl, cl->l, &age_x, &age_y);
+                        cairo_move_to(c, round(text_x * scale) + (double) age_x / PANGO_SCALE,
+                                         round(text_y * scale) + (double) age_y / PANGO_SCALE);
+                        pango_cairo_update_layout(c, cl->age);
+                        pango_cairo_show_layout(c, cl->age);
+                }
         }
 
         // progress bar positioning
@@ -931,6 +1142,34 @@ static void render_content(cairo_t *c, struct colored_layout *cl, int width, int
         }
 }
 
+static int layout_get_bg_height(struct colored_layout *cl, double scale)
+{
+        int bg_height = MAX(settings.height.min, 2 * settings.padding + layout_get_height(cl, scale));
+        return MIN(settings.height.max, bg_height);
+}
+
+/**
+ * @return How far the notification moves down the next one in the window
+ */
+static int layout_get_advance(struct colored_layout *cl, enum corner_pos corners, double scale)
+{
+        int advance = layout_get_bg_height(cl, scale);
+
+        /* adding frame */
+        if (corners & (C_TOP | _C_FIRST))
+                advance += settings.frame_width;
+
+        if (corners & (C_BOT | _C_LAST))
+                advance += settings.frame_width;
+
+        if (settings.gap_size)
+                advance += settings.gap_size;
+        else
+                advance += settings.separator_height;
+
+        return advance;
+}
+
 static struct dimensions layout_render(cairo_surface_t *srf,
                                        struct colored_layout *cl,
                                        struct colored_layout *cl_next,
@@ -938,30 +1177,16 @@ static struct dimensions layout_render(cairo_surface_t *srf,
                                        enum corner_pos corners)
 {
         double scale = output->get_scale();
-        const int cl_h = layout_get_height(cl, scale);
 
         int bg_width = 0;
-        int bg_height = MAX(settings.height.min, 2 * settings.padding + cl_h);
-        bg_height = MIN(settings.height.max, bg_height);
+        int bg_height = layout_get_bg_height(cl, scale);
 
         cairo_surface_t *content = render_background(srf, cl, cl_next, dim.y, dim.w, bg_height, dim.corner_radius, corners, &bg_width, scale);
         cairo_t *c = cairo_create(content);
 
         render_content(c, cl, bg_width, bg_height, scale);
 
-        /* adding frame */
-        if (corners & (C_TOP | _C_FIRST))
-                dim.y += settings.frame_width;
-
-        if (corners & (C_BOT | _C_LAST))
-                dim.y += settings.frame_width;
-
-        dim.y += bg_height;
-
-        if (settings.gap_size)
-                dim.y += settings.gap_size;
-        else
-                dim.y += settings.separator_height;
+        dim.y += layout_get_advance(cl, corners, scale);
 
         cairo_destroy(c);
         cairo_surface_destroy(content);
@@ -1018,6 +1243,159 @@ void calc_window_pos(const struct screen_info *scr, int width, int height, int *
         }
 }
 
+static guint hash_bytes(guint hash, const void *data, size_t len)
+{
+        const guchar *p = data;
+        for (size_t i = 0; i < len; i++)
+                hash = (hash ^ p[i]) * 16777619u;
+        return hash;
+}
+
+#define HASH_VALUE(hash, value) hash_bytes((hash), &(value), sizeof(value))
+
+/**
+ * Hash everything painting the notification depends on, apart from the
+ * window geometry. The separator below it takes the colors of the next one.
+ */
+static guint layout_hash(const struct colored_layout *cl, const struct colored_layout *cl_next,
+                         enum corner_pos corners)
+{
+        const struct notification *n = cl->n;
+        const char *text = cl->is_xmore ? cl->text : n->text_to_render;
+        const char *age = cl->age ? pango_layout_get_text(cl->age) : NULL;
+        int progress = have_progress_bar(cl) ? n->progress : -1;
+
+        guint hash = 2166136261u;
+        hash = hash_bytes(hash, STR_NN(text), strlen(STR_NN(text)) + 1);
+        hash = hash_bytes(hash, STR_NN(age), strlen(STR_NN(age)) + 1);
+        hash = hash_bytes(hash, STR_NN(n->icon_id), strlen(STR_NN(n->icon_id)) + 1);
+        hash = HASH_VALUE(hash, cl->icon);
+        hash = HASH_VALUE(hash, progress);
+        hash = HASH_VALUE(hash, corners);
+        hash = HASH_VALUE(hash, n->colors.fg);
+        hash = HASH_VALUE(hash, n->colors.bg);
+        hash = HASH_VALUE(hash, n->colors.frame);
+        hash = HASH_VALUE(hash, n->colors.highlight);
+        hash = HASH_VALUE(hash, n->icon_position);
+        hash = HASH_VALUE(hash, n->alignment);
+        hash = HASH_VALUE(hash, n->progress_bar_alignment);
+        hash = HASH_VALUE(hash, n->hide_text);
+
+        if (cl_next) {
+                hash = HASH_VALUE(hash, cl_next->n->colors.fg);
+                hash = HASH_VALUE(hash, cl_next->n->colors.bg);
+                hash = HASH_VALUE(hash, cl_next->n->colors.frame);
+        }
+
+        return hash;
+}
+
+static bool frame_matches(const struct draw_frame *f, const struct dimensions *dim, double scale)
+{
+        // Fractional scales blend neighbouring notifications in shared rows
+        return f->srf && f->bands
+                && f->w == dim->w && f->h == dim->h
+                && f->scale == scale && scale == round(scale)
+                && f->corner_radius == dim->corner_radius
+                && f->generation == layout_generation;
+}
+
+static void frame_reset(struct draw_frame *f)
+{
+        if (f->srf)
+                cairo_surface_destroy(f->srf);
+        if (f->bands)
+                g_array_unref(f->bands);
+        if (frames.last == f)
+                frames.last = NULL;
+        *f = (struct draw_frame) {0};
+}
+
+/**
+ * Find the frame held by the surface to render into, or the least recently
+ * used one to replace. Surfaces of the output are kept referenced, so their
+ * address can not be reused by a new buffer with different contents.
+ *
+ * @param target The buffer of the output, NULL to render into an own surface
+ */
+static struct draw_frame *frame_get(cairo_surface_t *target)
+{
+        struct draw_frame *lru = &frames.frames[0];
+        for (int i = 0; i < DRAW_FRAMES; i++) {
+                struct draw_frame *f = &frames.frames[i];
+                if (f->srf && (target ? f->srf == target : f->owned))
+                        return f;
+                if (f->used < lru->used)
+                        lru = f;
+        }
+
+        frame_reset(lru);
+        if (target) {
+                lru->srf = cairo_surface_reference(target);
+        } else {
+                lru->owned = true;
+        }
+        return lru;
+}
+
+/**
+ * Prepare the frame for the window dimensions.
+ *
+ * @param count The number of notifications to render
+ *
+ * @retval true if the frame can be painted over
+ * @retval false if the whole frame has to be painted
+ */
+static bool frame_prepare(struct draw_frame *f, const struct dimensions *dim, double scale, guint count)
+{
+        f->used = ++frames.count;
+        if (frame_matches(f, dim, scale) && f->bands->len == count)
+                return true;
+
+        if (f->owned && (!f->srf || f->w != dim->w || f->h != dim->h || f->scale != scale)) {
+                if (f->srf)
+                        cairo_surface_destroy(f->srf);
+                f->srf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                    round(dim->w * scale),
+                                                    round(dim->h * scale));
+        } else {
+                cairo_t *c = cairo_create(f->srf);
+                cairo_set_operator(c, CAIRO_OPERATOR_CLEAR);
+                cairo_paint(c);
+                cairo_destroy(c);
+        }
+
+        if (!f->bands)
+                f->bands = g_array_new(FALSE, FALSE, sizeof(struct draw_band));
+        g_array_set_size(f->bands, 0);
+
+        f->w = dim->w;
+        f->h = dim->h;
+        f->scale = scale;
+        f->corner_radius = dim->corner_radius;
+        f->generation = layout_generation;
+        return false;
+}
+
+static bool band_equal(const GArray *bands, guint i, const struct draw_band *band)
+{
+        if (i >= bands->len)
+                return false;
+
+        const struct draw_band *old = &g_array_index(bands, struct draw_band, i);
+        return old->y1 == band->y1 && old->y2 == band->y2 && old->hash == band->hash;
+}
+
+static cairo_rectangle_int_t band_rect(const struct draw_band *band, int width, double scale)
+{
+        return (cairo_rectangle_int_t) {
+                .x = 0,
+                .y = round(band->y1 * scale),
+                .width = round(width * scale),
+                .height = round(band->y2 * scale) - round(band->y1 * scale),
+        };
+}
+
 void draw(void)
 {
         assert(queues_length_displayed() > 0);
@@ -1034,12 +1412,21 @@ void draw(void)
         LOG_D("Window dimensions %ix%i", dim.w, dim.h);
         double scale = output->get_scale();
 
-        cairo_surface_t *image_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-                                                                    round(dim.w * scale),
-                                                                    round(dim.h * scale));
+        cairo_surface_t *target = output->win_get_buffer(win, round(dim.w * scale), round(dim.h * scale));
+        struct draw_frame *f = frame_get(target);
+        guint count = g_slist_length(layouts);
 
+        // What changed since the frame shown last has to be damaged, but the
+        // target may hold an older frame and needs everything changed since
+        // then to be rendered
+        struct draw_frame *last = frames.last;
+        bool partial_damage = last && frame_matches(last, &dim, scale) && last->bands->len == count;
+        bool partial = frame_prepare(f, &dim, scale, count);
+        cairo_region_t *damage = partial_damage ? cairo_region_create() : NULL;
+
+        guint i = 0;
         enum corner_pos corners = (settings.corners & C_TOP) | _C_FIRST;
-        for (GSList *iter = layouts; iter; iter = iter->next) {
+        for (GSList *iter = layouts; iter; iter = iter->next, i++) {
 
                 struct colored_layout *cl_this = iter->data;
                 struct colored_layout *cl_next = iter->next ? iter->next->data : NULL;
@@ -1049,18 +1436,52 @@ void draw(void)
                 else if (!cl_next)
                         corners |= (settings.corners & C_BOT) | _C_LAST;
 
-                dim = layout_render(image_surface, cl_this, cl_next, dim, corners);
+                struct draw_band band = {
+                        .y1 = dim.y,
+                        .y2 = dim.y + layout_get_advance(cl_this, corners, scale),
+                        .hash = layout_hash(cl_this, cl_next, corners),
+                };
+                cairo_rectangle_int_t rect = band_rect(&band, dim.w, scale);
+
+                if (damage && !band_equal(last->bands, i, &band))
+                        cairo_region_union_rectangle(damage, &rect);
+
+                if (partial && band_equal(f->bands, i, &band)) {
+                        dim.y = band.y2;
+                } else {
+                        if (partial) {
+                                cairo_t *c_band = cairo_create(f->srf);
+                                cairo_set_operator(c_band, CAIRO_OPERATOR_CLEAR);
+                                cairo_rectangle(c_band, rect.x, rect.y, rect.width, rect.height);
+                                cairo_fill(c_band);
+                                cairo_destroy(c_band);
+                        }
+                        dim = layout_render(f->srf, cl_this, cl_next, dim, corners);
+                }
+
+                if (i < f->bands->len)
+                        g_array_index(f->bands, struct draw_band, i) = band;
+                else
+                        g_array_append_val(f->bands, band);
                 corners &= ~(C_TOP | _C_FIRST);
         }
+        g_array_set_size(f->bands, i);
+        frames.last = f;
 
-        output->display_surface(image_surface, win, &dim);
+        LOG_D("Damaged %d rectangles of the window", damage ? cairo_region_num_rectangles(damage) : -1);
+        dim.damage = damage;
+        output->display_surface(f->srf, win, &dim);
 
-        cairo_surface_destroy(image_surface);
+        if (damage)
+                cairo_region_destroy(damage);
         g_slist_free_full(layouts, free_colored_layout);
 }
 
 void draw_deinit(void)
 {
+        for (int i = 0; i < DRAW_FRAMES; i++)
+                frame_reset(&frames.frames[i]);
+
         pango_font_description_free(pango_fdesc);
         output->win_destroy(win);
         output->deinit();
@@ -92,6 +92,13 @@ double draw_get_scale(void);
 
 void draw_deinit(void);
 
+struct layout_cache;
+
+/**
+ * Free the layouts cached on a notification
+ */
+void draw_layout_cache_free(struct layout_cache *cache);
+
 void calc_window_pos(const struct screen_info *scr, int width, int height, int *ret_x, int *ret_y);
 
 #endif
@@ -17,9 +17,12 @@
 #include "dunst.h"
 #include "dbus.h"
 #include "draw.h"
+#include "history_log.h"
+#include "icon.h"
 #include "log.h"
 #include "menu.h"
 #include "rules.h"
+#include "script.h"
 #include "notification.h"
 #include "option_parser.h"
 #include "queues.h"
@@ -29,6 +32,8 @@
 GMainLoop *mainloop = NULL;
 
 static struct dunst_status status;
+/** The fullscreen state has to be asked from the output again */
+static bool fullscreen_stale = true;
 static bool setup_done = false;
 char **config_paths = NULL;
 
@@ -38,6 +43,7 @@ void dunst_status(const enum dunst_status_field field, bool value)
         case S_FULLSCREEN:
                 LOG_D("Updated fullscreen state: %s\n", value ? "yes" : "no");
                 status.fullscreen = value;
+                fullscreen_stale = false;
                 break;
         case S_IDLE:
                 LOG_D("Updated idle state: %s\n", value ? "yes" : "no");
@@ -65,6 +71,18 @@ void dunst_status_int(const enum dunst_status_field field, int value)
         }
 }
 
+void dunst_status_invalidate(const enum dunst_status_field field)
+{
+        switch (field) {
+        case S_FULLSCREEN:
+                fullscreen_stale = true;
+                break;
+        default:
+                LOG_E("Invalid %s enum value in %s:%d for invalidation", "dunst_status", __FILE__, __LINE__);
+                break;
+        }
+}
+
 struct dunst_status dunst_status_get(void)
 {
         return status;
@@ -97,6 +115,44 @@ const char* dunst_run_reason_str(enum dunst_run_reason reason)
         }
 }
 
+/**
+ * Wake ups get handled together by one run, at most once per
+ * settings.coalesce_interval
+ */
+static struct {
+        guint source;     /**< The run scheduled for the pending wake ups */
+        gint64 last_run;
+        guint pending;    /**< Wake ups since the last run */
+        guint coalesced;  /**< Wake ups handled by the last run */
+} wakeups;
+
+/**
+ * What the window got drawn for last, so a run by the timer doesn't draw the
+ * same again
+ */
+static struct {
+        bool valid;         /**< The window is shown with the state below */
+        guint generation;   /**< See queues_generation() */
+        struct dunst_status status;
+        guint drawn;        /**< Runs which drew the window */
+        guint skipped;      /**< Runs which had nothing new to draw */
+} redraws;
+
+static bool dunst_status_equal(struct dunst_status a, struct dunst_status b)
+{
+        return a.fullscreen == b.fullscreen
+            && a.pause_level == b.pause_level
+            && a.idle == b.idle
+            && a.mouse_over == b.mouse_over;
+}
+
+static gboolean run_wakeups(gpointer data)
+{
+        (void)data;
+        wakeups.source = 0;
+        return run(GINT_TO_POINTER(DUNST_WAKEUP));
+}
+
 void wake_up(void)
 {
         // If wake_up is being called before the output has been setup we should
@@ -106,8 +162,37 @@ void wake_up(void)
                 return;
         }
 
-        LOG_D("Waking up");
-        run(GINT_TO_POINTER(DUNST_WAKEUP));
+        wakeups.pending++;
+        if (settings.coalesce_interval <= 0) {
+                LOG_D("Waking up");
+                run(GINT_TO_POINTER(DUNST_WAKEUP));
+                return;
+        }
+
+        if (wakeups.source)
+                return;
+
+        // A single event gets handled once the events pending in the main
+        // loop are, while a burst is limited to one run per interval
+        gint64 delay = wakeups.last_run + settings.coalesce_interval - time_monotonic_now();
+        delay = MAX(delay, 0);
+        LOG_D("Waking up in %"G_GINT64_FORMAT" ms", delay / 1000);
+        wakeups.source = g_timeout_add(delay / 1000, run_wakeups, NULL);
+}
+
+guint wake_ups_coalesced(void)
+{
+        return wakeups.coalesced;
+}
+
+guint redraws_drawn(void)
+{
+        return redraws.drawn;
+}
+
+guint redraws_skipped(void)
+{
+        return redraws.skipped;
 }
 
 static gboolean run(void *data)
@@ -142,7 +227,20 @@ static gboolean run(void *data)
         LOG_D("RUN, reason %i: %s", reason, dunst_run_reason_str(reason));
         gint64 now = time_monotonic_now();
 
-        dunst_status(S_FULLSCREEN, output->have_fullscreen_window());
+        // Any run handles the pending wake ups as well
+        if (wakeups.source) {
+                g_source_remove(wakeups.source);
+                wakeups.source = 0;
+        }
+        if (wakeups.pending > 1)
+                LOG_D("Handling %u wake ups at once", wakeups.pending);
+        wakeups.coalesced = wakeups.pending;
+        wakeups.pending = 0;
+        wakeups.last_run = now;
+
+        // The outputs keep the fullscreen state up to date by their events
+        if (fullscreen_stale)
+                dunst_status(S_FULLSCREEN, output->have_fullscreen_window());
         dunst_status(S_IDLE, output->is_idle());
 
         queues_update(status, now);
@@ -155,12 +253,29 @@ static gboolean run(void *data)
 
         if (!queues_length_displayed()) {
                 output->win_hide(win);
+                redraws.valid = false;
                 return G_SOURCE_REMOVE;
         }
 
-        // Call draw before showing the window to avoid flickering
-        draw();
-        output->win_show(win);
+        /* Anything but the timer may have changed what is shown, e.g. the
+         * settings or the screen, so only a run by the timer may skip */
+        guint generation = queues_generation(now);
+        if (reason == DUNST_TIMER && wakeups.coalesced == 0 && redraws.valid
+            && generation == redraws.generation
+            && dunst_status_equal(status, redraws.status)) {
+                redraws.skipped++;
+                LOG_D("Nothing changed, skipping the redraw (%u of %u skipped)",
+                      redraws.skipped, redraws.skipped + redraws.drawn);
+        } else {
+                // Call draw before showing the window to avoid flickering
+                draw();
+                output->win_show(win);
+
+                redraws.valid = true;
+                redraws.generation = generation;
+                redraws.status = status;
+                redraws.drawn++;
+        }
 
         gint64 timeout_at = queues_get_next_datachange(now);
         if (timeout_at != -1) {
@@ -216,12 +331,37 @@ gboolean quit_signal(gpointer data)
         return G_SOURCE_CONTINUE;
 }
 
+/**
+ * Restore the persistent history once dunst is idle after startup
+ */
+static gboolean history_restore(gpointer data)
+{
+        (void)data;
+        queues_history_restore();
+        wake_up();
+
+        return G_SOURCE_REMOVE;
+}
+
 static void teardown(void)
 {
+        if (wakeups.source) {
+                g_source_remove(wakeups.source);
+                wakeups.source = 0;
+        }
+
         regex_teardown();
 
         queues_teardown();
 
+        history_log_close();
+
+        script_teardown();
+
+        icon_loader_teardown();
+        icon_cache_clear();
+        icon_path_cache_clear();
+
         draw_deinit();
 
         g_strfreev(config_paths);
@@ -244,9 +384,11 @@ void reload(char **const configs)
 
         settings_free(&settings);
         load_settings(length != 0 ? configs : config_paths);
+        icon_path_cache_clear();
 
         draw_setup();
         setup_done = true;
+        dunst_status_invalidate(S_FULLSCREEN);
 
         queues_reapply_all_rules();
 
@@ -262,6 +404,24 @@ void reload(char **const configs)
 #define CMDLINE_STARTNOTIF "-startup_notification/--startup_notification"
 #define CMDLINE_HELP "-h/-help/--help"
 
+/**
+ * Writes to a pipe whose reader went away fail with EPIPE instead of
+ * killing dunst. A handler doing nothing is used in place of SIG_IGN,
+ * since spawned commands get it reset to the default, while an ignored
+ * SIGPIPE would stay ignored for them.
+ */
+static void sigpipe_handler(int sig)
+{
+        (void) sig;
+}
+
+static void sigpipe_setup(void)
+{
+        struct sigaction action = { .sa_handler = sigpipe_handler, .sa_flags = SA_RESTART };
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPIPE, &action, NULL);
+}
+
 int dunst_main(int argc, char *argv[])
 {
         dunst_status_int(S_PAUSE_LEVEL, 0);
@@ -306,6 +466,14 @@ int dunst_main(int argc, char *argv[])
         }
 
         load_settings(config_paths);
+
+        if (settings.history_persist) {
+                char *history_path = history_log_default_path();
+                if (history_log_open(history_path))
+                        g_idle_add_full(G_PRIORITY_LOW, history_restore, NULL, NULL);
+                g_free(history_path);
+        }
+
         int dbus_owner_id = dbus_init();
 
         mainloop = g_main_loop_new(NULL, FALSE);
@@ -319,6 +487,8 @@ int dunst_main(int argc, char *argv[])
         guint term_src = g_unix_signal_add(SIGTERM, quit_signal, NULL);
         guint int_src = g_unix_signal_add(SIGINT, quit_signal, NULL);
 
+        sigpipe_setup();
+
 
         if (startnotif) {
                 struct notification *n = notification_create();
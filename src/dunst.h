@@ -45,9 +45,38 @@ extern char **config_paths;
 void dunst_status(const enum dunst_status_field field, bool value);
 void dunst_status_int(const enum dunst_status_field field, int value);
 
+/**
+ * Have the field of the status asked from the output again on the next
+ * update, as an event may have changed it. Only S_FULLSCREEN is cached.
+ *
+ * @param field The field to query again
+ */
+void dunst_status_invalidate(const enum dunst_status_field field);
+
 struct dunst_status dunst_status_get(void);
 
+/**
+ * Update the queues and the window, after a short delay in which further
+ * wake ups get coalesced
+ */
 void wake_up(void);
+
+/**
+ * @return the number of wake ups handled by the last update
+ */
+guint wake_ups_coalesced(void);
+
+/**
+ * @return the number of runs, which drew the window
+ */
+guint redraws_drawn(void);
+
+/**
+ * @return the number of runs by the timer, which skipped drawing the window
+ *         as nothing visible changed
+ */
+guint redraws_skipped(void);
+
 void reload(char **const configs);
 
 int dunst_main(int argc, char *argv[]);
@@ -0,0 +1,387 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @file
+ * @copyright Copyright 2014-2026 Dunst contributors
+ * @license BSD-3-Clause
+ */
+
+#include "history_log.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "notification.h"
+#include "utils.h"
+
+/**
+ * Magic bytes at the start of the file, containing the format version
+ */
+#define HISTORY_LOG_MAGIC "DUNSTHL\001"
+#define HISTORY_LOG_MAGIC_LEN 8
+
+/**
+ * Records are aligned to 8 bytes, so their payload can be read as GVariant
+ * directly from the mapped file.
+ */
+#define HISTORY_LOG_ALIGN 8
+
+/**
+ * Each record starts with its payload length as little endian guint32,
+ * followed by padding up to #HISTORY_LOG_ALIGN.
+ */
+#define HISTORY_LOG_RECORD_HEADER 8
+
+/**
+ * The payload of a record: the record kind, the notification id and the
+ * fields of the notification (empty for anything but #HISTORY_LOG_ADD).
+ */
+#define HISTORY_LOG_RECORD_TYPE G_VARIANT_TYPE("(yia{sv})")
+
+enum history_log_kind {
+        HISTORY_LOG_ADD = 'a',
+        HISTORY_LOG_REMOVE = 'r',
+        HISTORY_LOG_CLEAR = 'c',
+};
+
+static struct {
+        char *path;
+        GMappedFile *map; /**< The file contents until they are loaded */
+        FILE *file;       /**< Opened for appending records */
+        guint records;
+} history_log = { 0 };
+
+char *history_log_default_path(void)
+{
+        const char *state_home = g_getenv("XDG_STATE_HOME");
+        if (STR_FULL(state_home) && g_path_is_absolute(state_home))
+                return g_build_filename(state_home, "dunst", "history.log", NULL);
+
+        return g_build_filename(g_get_home_dir(), ".local", "state", "dunst", "history.log", NULL);
+}
+
+bool history_log_is_open(void)
+{
+        return history_log.file != NULL;
+}
+
+guint history_log_records(void)
+{
+        return history_log.records;
+}
+
+/**
+ * Serialize a record in little endian and append it to the buffer
+ */
+static void history_log_record_serialize(GByteArray *buf, enum history_log_kind kind,
+                                         gint id, GVariant *fields)
+{
+        if (!fields)
+                fields = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
+
+        GVariant *record = g_variant_ref_sink(g_variant_new("(yi@a{sv})", kind, id, fields));
+        if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+                GVariant *swapped = g_variant_byteswap(record);
+                g_variant_unref(record);
+                record = swapped;
+        }
+
+        gsize size = g_variant_get_size(record);
+        guint8 header[HISTORY_LOG_RECORD_HEADER] = { 0 };
+        guint32 len = GUINT32_TO_LE((guint32) size);
+        memcpy(header, &len, sizeof(len));
+
+        g_byte_array_append(buf, header, sizeof(header));
+        g_byte_array_set_size(buf, buf->len + size);
+        g_variant_store(record, buf->data + buf->len - size);
+
+        static const guint8 padding[HISTORY_LOG_ALIGN] = { 0 };
+        gsize pad = (HISTORY_LOG_ALIGN - size % HISTORY_LOG_ALIGN) % HISTORY_LOG_ALIGN;
+        g_byte_array_append(buf, padding, pad);
+
+        g_variant_unref(record);
+}
+
+static GVariant *history_log_fields(const struct notification *n)
+{
+        GVariantBuilder b;
+        g_variant_builder_init(&b, G_VARIANT_TYPE("a{sv}"));
+
+        const struct {
+                const char *key;
+                const char *value;
+        } strings[] = {
+                { "appname",       n->appname },
+                { "summary",       n->summary },
+                { "body",          n->body },
+                { "category",      n->category },
+                { "desktop_entry", n->desktop_entry },
+                { "icon",          n->iconname },
+                { "stack_tag",     n->stack_tag },
+        };
+        for (size_t i = 0; i < G_N_ELEMENTS(strings); i++) {
+                if (strings[i].value)
+                        g_variant_builder_add(&b, "{sv}", strings[i].key,
+                                              g_variant_new_string(strings[i].value));
+        }
+
+        // The timestamp is monotonic, so store the wall clock time of it
+        gint64 realtime = g_get_real_time() - (time_monotonic_now() - n->timestamp);
+
+        g_variant_builder_add(&b, "{sv}", "urgency", g_variant_new_byte(n->urgency));
+        g_variant_builder_add(&b, "{sv}", "progress", g_variant_new_int32(n->progress));
+        g_variant_builder_add(&b, "{sv}", "time", g_variant_new_int64(realtime));
+
+        return g_variant_builder_end(&b);
+}
+
+/**
+ * Write the buffer to the end of the log. Closes the log on failure.
+ */
+static void history_log_write(const GByteArray *buf)
+{
+        if (fwrite(buf->data, 1, buf->len, history_log.file) != buf->len
+            || fflush(history_log.file) != 0) {
+                LOG_W("Failed to write history log '%s': %s. Disabling it.",
+                      history_log.path, strerror(errno));
+                history_log_close();
+        }
+}
+
+static void history_log_append_record(enum history_log_kind kind, gint id, GVariant *fields)
+{
+        ASSERT_OR_RET(history_log_is_open(),);
+
+        GByteArray *buf = g_byte_array_new();
+        history_log_record_serialize(buf, kind, id, fields);
+        history_log.records++;
+        history_log_write(buf);
+        g_byte_array_unref(buf);
+}
+
+void history_log_append(const struct notification *n)
+{
+        ASSERT_OR_RET(history_log_is_open(),);
+        history_log_append_record(HISTORY_LOG_ADD, n->id, history_log_fields(n));
+}
+
+void history_log_remove(gint id)
+{
+        history_log_append_record(HISTORY_LOG_REMOVE, id, NULL);
+}
+
+void history_log_clear(void)
+{
+        history_log_rewrite(NULL);
+}
+
+void history_log_rewrite(GList *notifications)
+{
+        ASSERT_OR_RET(history_log_is_open(),);
+
+        GByteArray *buf = g_byte_array_new();
+        g_byte_array_append(buf, (const guint8 *) HISTORY_LOG_MAGIC, HISTORY_LOG_MAGIC_LEN);
+
+        guint records = 0;
+        for (const GList *iter = notifications; iter; iter = iter->next) {
+                const struct notification *n = iter->data;
+                history_log_record_serialize(buf, HISTORY_LOG_ADD, n->id, history_log_fields(n));
+                records++;
+        }
+
+        // Write the new log next to the old one and replace it atomically,
+        // so the history isn't lost when dunst is killed in between
+        GError *err = NULL;
+        if (!g_file_set_contents(history_log.path, (const char *) buf->data, buf->len, &err)) {
+                LOG_W("Failed to rewrite history log: %s", err->message);
+                g_error_free(err);
+                g_byte_array_unref(buf);
+                return;
+        }
+        g_byte_array_unref(buf);
+
+        // The old file got replaced, so the handle has to follow
+        fclose(history_log.file);
+        history_log.file = fopen(history_log.path, "ab");
+        if (!history_log.file) {
+                LOG_W("Failed to reopen history log '%s': %s. Disabling it.",
+                      history_log.path, strerror(errno));
+                history_log_close();
+                return;
+        }
+        history_log.records = records;
+}
+
+bool history_log_open(const char *path)
+{
+        ASSERT_OR_RET(path, false);
+
+        history_log_close();
+
+        char *dir = g_path_get_dirname(path);
+        if (g_mkdir_with_parents(dir, 0700) != 0) {
+                LOG_W("Failed to create directory '%s' for the history log: %s",
+                      dir, strerror(errno));
+                g_free(dir);
+                return false;
+        }
+        g_free(dir);
+
+        GError *err = NULL;
+        GMappedFile *map = g_mapped_file_new(path, FALSE, &err);
+        if (err) {
+                if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        LOG_W("Failed to map history log '%s': %s", path, err->message);
+                g_error_free(err);
+        }
+
+        if (map && g_mapped_file_get_length(map) == 0) {
+                g_clear_pointer(&map, g_mapped_file_unref);
+        } else if (map && (g_mapped_file_get_length(map) < HISTORY_LOG_MAGIC_LEN
+                           || memcmp(g_mapped_file_get_contents(map),
+                                     HISTORY_LOG_MAGIC, HISTORY_LOG_MAGIC_LEN) != 0)) {
+                LOG_W("History log '%s' has an unknown format, starting a new one", path);
+                g_clear_pointer(&map, g_mapped_file_unref);
+        }
+
+        FILE *file = fopen(path, "ab");
+        if (!file) {
+                LOG_W("Failed to open history log '%s': %s", path, strerror(errno));
+                g_clear_pointer(&map, g_mapped_file_unref);
+                return false;
+        }
+
+        history_log.path = g_strdup(path);
+        history_log.file = file;
+        history_log.map = map;
+        history_log.records = 0;
+
+        if (!map)
+                history_log_rewrite(NULL);
+
+        return history_log_is_open();
+}
+
+/**
+ * Create an initialized notification from the fields of an add record
+ */
+static struct notification *history_log_notification_new(GVariant *fields)
+{
+        struct notification *n = notification_create();
+
+        g_variant_lookup(fields, "appname", "s", &n->appname);
+        g_variant_lookup(fields, "summary", "s", &n->summary);
+        g_variant_lookup(fields, "body", "s", &n->body);
+        g_variant_lookup(fields, "category", "s", &n->category);
+        g_variant_lookup(fields, "desktop_entry", "s", &n->desktop_entry);
+        g_variant_lookup(fields, "icon", "s", &n->iconname);
+        g_variant_lookup(fields, "stack_tag", "s", &n->stack_tag);
+
+        guint8 urgency;
+        if (g_variant_lookup(fields, "urgency", "y", &urgency) && urgency <= URG_MAX)
+                n->urgency = urgency;
+        g_variant_lookup(fields, "progress", "i", &n->progress);
+
+        n->dbus_valid = false;
+        notification_init(n);
+
+        gint64 realtime;
+        if (g_variant_lookup(fields, "time", "x", &realtime))
+                n->timestamp = time_monotonic_now() - (g_get_real_time() - realtime);
+
+        return n;
+}
+
+GList *history_log_load(guint max)
+{
+        ASSERT_OR_RET(history_log_is_open() && history_log.map, NULL);
+
+        GBytes *bytes = g_mapped_file_get_bytes(history_log.map);
+        gsize size = g_bytes_get_size(bytes);
+        const guint8 *data = g_bytes_get_data(bytes, NULL);
+
+        // The add records still in history, newest at the tail. Only the
+        // ones which survive are turned into notifications.
+        GQueue adds = G_QUEUE_INIT;
+        guint records = 0;
+
+        gsize offset = HISTORY_LOG_MAGIC_LEN;
+        while (offset + HISTORY_LOG_RECORD_HEADER <= size) {
+                guint32 len;
+                memcpy(&len, data + offset, sizeof(len));
+                len = GUINT32_FROM_LE(len);
+
+                gsize start = offset + HISTORY_LOG_RECORD_HEADER;
+                if (len > size - start) {
+                        LOG_W("History log '%s' is truncated", history_log.path);
+                        break;
+                }
+
+                GBytes *payload = g_bytes_new_from_bytes(bytes, start, len);
+                GVariant *record = g_variant_ref_sink(
+                                g_variant_new_from_bytes(HISTORY_LOG_RECORD_TYPE, payload, FALSE));
+                g_bytes_unref(payload);
+                if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+                        GVariant *swapped = g_variant_byteswap(record);
+                        g_variant_unref(record);
+                        record = swapped;
+                }
+
+                guint8 kind;
+                gint id;
+                g_variant_get(record, "(yi@a{sv})", &kind, &id, NULL);
+
+                if (kind == HISTORY_LOG_ADD) {
+                        g_queue_push_tail(&adds, g_variant_ref(record));
+                } else if (kind == HISTORY_LOG_REMOVE) {
+                        for (GList *iter = adds.tail; iter; iter = iter->prev) {
+                                gint add_id;
+                                g_variant_get(iter->data, "(yi@a{sv})", NULL, &add_id, NULL);
+                                if (add_id == id) {
+                                        g_variant_unref(iter->data);
+                                        g_queue_delete_link(&adds, iter);
+                                        break;
+                                }
+                        }
+                } else if (kind == HISTORY_LOG_CLEAR) {
+                        g_queue_clear_full(&adds, (GDestroyNotify) g_variant_unref);
+                }
+
+                g_variant_unref(record);
+                records++;
+                offset = start + len + (HISTORY_LOG_ALIGN - len % HISTORY_LOG_ALIGN) % HISTORY_LOG_ALIGN;
+        }
+
+        while (max > 0 && adds.length > max)
+                g_variant_unref(g_queue_pop_head(&adds));
+
+        GList *notifications = NULL;
+        GVariant *record;
+        while ((record = g_queue_pop_tail(&adds))) {
+                GVariant *fields = g_variant_get_child_value(record, 2);
+                struct notification *n = history_log_notification_new(fields);
+                g_variant_get(record, "(yi@a{sv})", NULL, &n->id, NULL);
+                notifications = g_list_prepend(notifications, n);
+                g_variant_unref(fields);
+                g_variant_unref(record);
+        }
+
+        g_bytes_unref(bytes);
+        g_clear_pointer(&history_log.map, g_mapped_file_unref);
+        history_log.records = records;
+
+        return notifications;
+}
+
+void history_log_close(void)
+{
+        g_clear_pointer(&history_log.map, g_mapped_file_unref);
+        if (history_log.file) {
+                fclose(history_log.file);
+                history_log.file = NULL;
+        }
+        g_clear_pointer(&history_log.path, g_free);
+        history_log.records = 0;
+}
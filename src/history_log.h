@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @file
+ * @ingroup notify
+ * @brief Persistent on-disk log of the notification history
+ * @copyright Copyright 2014-2026 Dunst contributors
+ * @license BSD-3-Clause
+ *
+ * The log is an append-only file of length-prefixed records. A record
+ * either adds a notification to the history, removes one by its id or
+ * clears the history. The file is only mapped by history_log_open() and
+ * gets parsed by history_log_load() once the history is needed.
+ *
+ * All functions except history_log_open() do nothing when the log is not
+ * open, so callers do not have to check whether the log is enabled.
+ */
+
+#ifndef DUNST_HISTORY_LOG_H
+#define DUNST_HISTORY_LOG_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+#include "notification.h"
+
+/**
+ * Get the default location of the log, inside `$XDG_STATE_HOME/dunst`
+ *
+ * @return (transfer full) the path of the log file
+ */
+char *history_log_default_path(void);
+
+/**
+ * Open the log at the given path and map its contents without parsing
+ * them. A missing file is created.
+ *
+ * @param path The path of the log file
+ *
+ * @retval true if the log is open
+ * @retval false if the log could not be opened
+ */
+bool history_log_open(const char *path);
+
+/**
+ * @return whether a log is open
+ */
+bool history_log_is_open(void);
+
+/**
+ * Parse the mapped log and create the notifications remaining in history.
+ * Unmaps the file afterwards, so this returns notifications only on the
+ * first call after history_log_open().
+ *
+ * The notifications are initialized, but keep the ids from the log. As the
+ * ids get reused between restarts, the caller has to assign new ones and
+ * history_log_rewrite() the log.
+ *
+ * @param max The maximum number of notifications to create, 0 for all
+ *
+ * @return (transfer full) the notifications from the oldest to the newest
+ */
+GList *history_log_load(guint max);
+
+/**
+ * Append a notification pushed to history to the log
+ *
+ * @param n The notification
+ */
+void history_log_append(const struct notification *n);
+
+/**
+ * Note the removal of the notification with the given id from history
+ *
+ * @param id The id of the removed notification
+ */
+void history_log_remove(gint id);
+
+/**
+ * Clear the log
+ */
+void history_log_clear(void);
+
+/**
+ * Replace the contents of the log with the given notifications
+ *
+ * @param notifications The complete history from the oldest to the newest
+ */
+void history_log_rewrite(GList *notifications);
+
+/**
+ * @return the number of records in the log, to decide when to compact it
+ *         with history_log_rewrite()
+ */
+guint history_log_records(void);
+
+/**
+ * Close the log
+ */
+void history_log_close(void);
+
+#endif
@@ -9,7 +9,9 @@
 #include "icon-lookup.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 
@@ -22,6 +24,101 @@ int icon_themes_count = 0;
 int *default_themes_index = NULL;
 int default_themes_count = 0;
 
+/** The file suffixes of icons, in the order of preference */
+static const char *icon_suffixes[] = { ".svg", ".svgz", ".png", ".xpm", NULL };
+
+/** How often the directories of a theme are checked for changes */
+#define ICON_INDEX_RECHECK_INTERVAL S2US(5)
+
+static gint64 icon_theme_dir_mtime(const struct icon_theme *theme, const struct icon_theme_dir *dir)
+{
+        char *path = g_build_filename(theme->location, theme->subdir_theme, dir->name, NULL);
+        GStatBuf statbuf;
+        gint64 mtime = g_stat(path, &statbuf) == 0 ? (gint64) statbuf.st_mtime : -1;
+        g_free(path);
+        return mtime;
+}
+
+/**
+ * Scan all directories of the theme and map the names of the icons in them
+ * to the directories and suffixes they exist with. The entries of a name
+ * are sorted by the order of the directories in index.theme.
+ */
+static void icon_theme_index_build(struct icon_theme *theme)
+{
+        if (theme->index)
+                g_hash_table_remove_all(theme->index);
+        else
+                theme->index = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                     g_free, (GDestroyNotify) g_array_unref);
+
+        for (int i = 0; i < theme->dirs_count; i++) {
+                theme->dirs[i].mtime = icon_theme_dir_mtime(theme, &theme->dirs[i]);
+
+                char *path = g_build_filename(theme->location, theme->subdir_theme,
+                                              theme->dirs[i].name, NULL);
+                GDir *dir = g_dir_open(path, 0, NULL);
+                g_free(path);
+                if (!dir)
+                        continue;
+
+                const char *file;
+                while ((file = g_dir_read_name(dir))) {
+                        int suf = 0;
+                        while (icon_suffixes[suf] && !g_str_has_suffix(file, icon_suffixes[suf]))
+                                suf++;
+                        if (!icon_suffixes[suf])
+                                continue;
+
+                        char *name = g_strndup(file, strlen(file) - strlen(icon_suffixes[suf]));
+                        GArray *entries = g_hash_table_lookup(theme->index, name);
+                        if (entries) {
+                                g_free(name);
+                        } else {
+                                entries = g_array_new(FALSE, FALSE, sizeof(struct icon_index_entry));
+                                g_hash_table_insert(theme->index, name, entries);
+                        }
+
+                        struct icon_index_entry *last = entries->len == 0 ? NULL
+                                : &g_array_index(entries, struct icon_index_entry, entries->len - 1);
+                        if (last && last->dir == i) {
+                                last->suffixes |= 1u << suf;
+                        } else {
+                                struct icon_index_entry entry = { .dir = i, .suffixes = 1u << suf };
+                                g_array_append_val(entries, entry);
+                        }
+                }
+                g_dir_close(dir);
+        }
+
+        theme->index_checked = time_monotonic_now();
+        LOG_D("Indexed %u icons of theme %s", g_hash_table_size(theme->index), STR_NN(theme->name));
+}
+
+/**
+ * Rebuild the index of the theme, if one of its directories changed. The
+ * directories are checked at most every #ICON_INDEX_RECHECK_INTERVAL.
+ */
+static void icon_theme_index_refresh(struct icon_theme *theme)
+{
+        gint64 now = time_monotonic_now();
+        if (theme->index && now - theme->index_checked < ICON_INDEX_RECHECK_INTERVAL)
+                return;
+
+        theme->index_checked = now;
+        for (int i = 0; theme->index && i < theme->dirs_count; i++) {
+                if (icon_theme_dir_mtime(theme, &theme->dirs[i]) != theme->dirs[i].mtime) {
+                        LOG_D("Directory %s of theme %s changed",
+                              theme->dirs[i].name, STR_NN(theme->name));
+                        icon_theme_index_build(theme);
+                        return;
+                }
+        }
+
+        if (!theme->index)
+                icon_theme_index_build(theme);
+}
+
 int get_icon_theme(char *name) {
         for (int i = 0; i < icon_themes_count; i++) {
                 if (STR_EQ(icon_themes[i].subdir_theme, name)) {
@@ -68,6 +165,7 @@ int load_icon_theme_from_dir(const char *icon_dir, const char *subdir_theme) {
         icon_themes[index].subdir_theme = g_strdup(subdir_theme);
         icon_themes[index].inherits_index = NULL;
         icon_themes[index].inherits_count = 0;
+        icon_themes[index].index = NULL;
 
         // load theme directories
         icon_themes[index].dirs_count = ini->section_count - 1;
@@ -124,6 +222,8 @@ int load_icon_theme_from_dir(const char *icon_dir, const char *subdir_theme) {
                 }
         }
 
+        icon_theme_index_build(&icon_themes[index]);
+
 
         // load inherited themes
         if (!STR_EQ(icon_themes[index].name, "Hicolor")) {
@@ -212,6 +312,7 @@ void finish_icon_theme(struct icon_theme *theme) {
         g_free(theme->subdir_theme);
         g_free(theme->inherits_index);
         g_free(theme->dirs);
+        g_clear_pointer(&theme->index, g_hash_table_unref);
 }
 
 void free_all_themes(void) {
@@ -246,41 +347,50 @@ void add_default_theme(int theme_index) {
         default_themes_index[default_themes_count - 1] = theme_index;
 }
 
+static bool icon_theme_dir_matches_size(const struct icon_theme_dir *dir, int size)
+{
+        switch (dir->type) {
+                case THEME_DIR_FIXED:
+                        return dir->size == size;
+
+                case THEME_DIR_SCALABLE:
+                        return dir->min_size <= size && dir->max_size >= size;
+
+                case THEME_DIR_THRESHOLD:
+                        return (float)dir->size / dir->threshold <= size
+                                && dir->size * dir->threshold >= size;
+        }
+        return false;
+}
+
 // see icon-lookup.h
 char *find_icon_in_theme(const char *name, int theme_index, int size) {
         struct icon_theme *theme = &icon_themes[theme_index];
         LOG_D("Finding icon %s in theme %s", STR_NN(name), STR_NN(theme->name));
-        for (int i = 0; i < theme->dirs_count; i++) {
-                bool match_size = false;
-                struct icon_theme_dir dir = theme->dirs[i];
-                switch (dir.type) {
-                        case THEME_DIR_FIXED:
-                                match_size = dir.size == size;
-                                break;
-
-                        case THEME_DIR_SCALABLE:
-                                match_size = dir.min_size <= size && dir.max_size >= size;
-                                break;
-
-                        case THEME_DIR_THRESHOLD:
-                                match_size = (float)dir.size / dir.threshold <= size
-                                        && dir.size * dir.threshold >= size;
-                                break;
-                }
-                if (match_size) {
-                        const char *suffixes[] = { ".svg", ".svgz", ".png", ".xpm", NULL };
-                        for (const char **suf = suffixes; *suf; suf++) {
-                                char *name_with_extension = g_strconcat(name, *suf, NULL);
-                                char *icon = g_build_filename(theme->location, theme->subdir_theme,
-                                                dir.name, name_with_extension,
-                                                NULL);
-                                if (is_readable_file(icon)) {
-                                        g_free(name_with_extension);
-                                        return icon;
-                                }
-                                g_free(name_with_extension);
-                                g_free(icon);
-                        }
+
+        icon_theme_index_refresh(theme);
+
+        const GArray *entries = g_hash_table_lookup(theme->index, name);
+        for (guint i = 0; entries && i < entries->len; i++) {
+                struct icon_index_entry entry = g_array_index(entries, struct icon_index_entry, i);
+                const struct icon_theme_dir *dir = &theme->dirs[entry.dir];
+                if (!icon_theme_dir_matches_size(dir, size))
+                        continue;
+
+                for (int suf = 0; icon_suffixes[suf]; suf++) {
+                        if (!(entry.suffixes & (1u << suf)))
+                                continue;
+
+                        char *name_with_extension = g_strconcat(name, icon_suffixes[suf], NULL);
+                        char *icon = g_build_filename(theme->location, theme->subdir_theme,
+                                        dir->name, name_with_extension,
+                                        NULL);
+                        g_free(name_with_extension);
+
+                        // The file may have been removed since indexing
+                        if (is_readable_file(icon))
+                                return icon;
+                        g_free(icon);
                 }
         }
         return NULL;
@@ -10,6 +10,8 @@
 #ifndef DUNST_ICON_LOOKUP_H
 #define DUNST_ICON_LOOKUP_H
 
+#include <glib.h>
+
 struct icon_theme {
         char *name;
         char *location; // full path to the theme
@@ -20,6 +22,17 @@ struct icon_theme {
 
         int dirs_count;
         struct icon_theme_dir *dirs;
+
+        GHashTable *index; // icon name -> GArray of struct icon_index_entry
+        gint64 index_checked; // when the directories were last checked for changes
+};
+
+/**
+ * The icon files with one name in one directory of a theme
+ */
+struct icon_index_entry {
+        int dir;          // index into icon_theme.dirs
+        unsigned suffixes; // bitmask of the suffixes the icon exists with
 };
 
 enum theme_dir_type { THEME_DIR_FIXED, THEME_DIR_SCALABLE, THEME_DIR_THRESHOLD };
@@ -31,6 +44,7 @@ struct icon_theme_dir {
         int min_size, max_size;
         int threshold;
         enum theme_dir_type type;
+        gint64 mtime; // modification time of the directory when it was indexed
 };
 
 
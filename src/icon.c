@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <cairo.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
@@ -18,9 +19,281 @@
 #include "utils.h"
 #include "icon-lookup.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PIXEL_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+/**
+ * Premultiply the color channel c with the alpha a. Rounds to the nearest
+ * integer like `c * (a / 255.0) + .5`, but without the division.
+ */
+static inline uint32_t premultiply(uint32_t c, uint32_t a)
+{
+        uint32_t t = c * a + 0x80;
+        return (t + (t >> 8)) >> 8;
+}
+
+/*
+ * The row kernels convert width pixels of a GdkPixbuf row to native endian
+ * 32 bit words, which is how cairo defines its formats. The vectorized ones
+ * convert as many pixels as they can in blocks and leave the rest to the
+ * scalar ones. They all have to produce the same output bit for bit.
+ */
+
+static void pixel_row_rgb_scalar(const unsigned char *p, uint32_t *c, int width)
+{
+        for (int w = 0; w < width; w++, p += 3)
+                c[w] = 0xff000000u
+                     | (uint32_t) p[0] << 16
+                     | (uint32_t) p[1] << 8
+                     | (uint32_t) p[2];
+}
+
+static void pixel_row_rgba_scalar(const unsigned char *p, uint32_t *c, int width)
+{
+        for (int w = 0; w < width; w++, p += 4) {
+                uint32_t alpha = p[3];
+                // Opaque and fully transparent pixels skip the premultiplication
+                if (alpha == 0xff)
+                        c[w] = 0xff000000u
+                             | (uint32_t) p[0] << 16
+                             | (uint32_t) p[1] << 8
+                             | (uint32_t) p[2];
+                else if (alpha == 0)
+                        c[w] = 0;
+                else
+                        c[w] = alpha << 24
+                             | premultiply(p[0], alpha) << 16
+                             | premultiply(p[1], alpha) << 8
+                             | premultiply(p[2], alpha);
+        }
+}
+
+#ifdef PIXEL_KERNELS_X86
+/*
+ * Premultiply two RGBA pixels widened to 16 bit lanes and swap them to BGRA,
+ * which is the memory order of a little endian ARGB word. The alpha lanes
+ * get multiplied with 0xff, which keeps them as they are.
+ */
+__attribute__((target("sse2")))
+static inline __m128i premultiply_sse2(__m128i v)
+{
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)),
+                                        _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_or_si128(_mm_and_si128(a, _mm_set1_epi64x(0x0000ffffffffffffLL)),
+                         _mm_set1_epi64x(0x00ff000000000000LL));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 0, 1, 2)),
+                                _MM_SHUFFLE(3, 0, 1, 2));
+
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, a), _mm_set1_epi16(0x80));
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void pixel_row_rgba_sse2(const unsigned char *p, uint32_t *c, int width)
+{
+        const __m128i zero = _mm_setzero_si128();
+        int w = 0;
+        for (; w + 4 <= width; w += 4, p += 16) {
+                __m128i px = _mm_loadu_si128((const __m128i *) p);
+                __m128i lo = premultiply_sse2(_mm_unpacklo_epi8(px, zero));
+                __m128i hi = premultiply_sse2(_mm_unpackhi_epi8(px, zero));
+                _mm_storeu_si128((__m128i *) (c + w), _mm_packus_epi16(lo, hi));
+        }
+        pixel_row_rgba_scalar(p, c + w, width - w);
+}
+
+__attribute__((target("ssse3")))
+static void pixel_row_rgb_ssse3(const unsigned char *p, uint32_t *c, int width)
+{
+        // RGB to BGR and a zero byte, which the alpha gets or'ed into
+        const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                                            8, 7, 6, -1, 11, 10, 9, -1);
+        const __m128i alpha = _mm_set1_epi32(0xff000000);
+        int w = 0;
+        // Each load reads 16 bytes for 4 pixels, so 2 more have to follow
+        for (; w + 6 <= width; w += 4, p += 12) {
+                __m128i px = _mm_loadu_si128((const __m128i *) p);
+                px = _mm_or_si128(_mm_shuffle_epi8(px, order), alpha);
+                _mm_storeu_si128((__m128i *) (c + w), px);
+        }
+        pixel_row_rgb_scalar(p, c + w, width - w);
+}
+
+/* Same as premultiply_sse2(), but for four pixels */
+__attribute__((target("avx2")))
+static inline __m256i premultiply_avx2(__m256i v)
+{
+        __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)),
+                                           _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm256_or_si256(_mm256_and_si256(a, _mm256_set1_epi64x(0x0000ffffffffffffLL)),
+                            _mm256_set1_epi64x(0x00ff000000000000LL));
+        v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 0, 1, 2)),
+                                   _MM_SHUFFLE(3, 0, 1, 2));
+
+        __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(0x80));
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void pixel_row_rgba_avx2(const unsigned char *p, uint32_t *c, int width)
+{
+        const __m256i zero = _mm256_setzero_si256();
+        int w = 0;
+        // Unpacking and packing work within the 128 bit lanes, so the
+        // order of the pixels is kept
+        for (; w + 8 <= width; w += 8, p += 32) {
+                __m256i px = _mm256_loadu_si256((const __m256i *) p);
+                __m256i lo = premultiply_avx2(_mm256_unpacklo_epi8(px, zero));
+                __m256i hi = premultiply_avx2(_mm256_unpackhi_epi8(px, zero));
+                _mm256_storeu_si256((__m256i *) (c + w), _mm256_packus_epi16(lo, hi));
+        }
+        pixel_row_rgba_scalar(p, c + w, width - w);
+}
+
+__attribute__((target("avx2")))
+static void pixel_row_rgb_avx2(const unsigned char *p, uint32_t *c, int width)
+{
+        // Shuffles only work within the 128 bit lanes, so each one gets
+        // loaded with 4 pixels on its own
+        const __m256i order = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                                               8, 7, 6, -1, 11, 10, 9, -1,
+                                               2, 1, 0, -1, 5, 4, 3, -1,
+                                               8, 7, 6, -1, 11, 10, 9, -1);
+        const __m256i alpha = _mm256_set1_epi32(0xff000000);
+        int w = 0;
+        // The upper load reads 16 bytes from pixel 4, so 2 more have to follow
+        for (; w + 10 <= width; w += 8, p += 24) {
+                __m256i px = _mm256_inserti128_si256(
+                                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) p)),
+                                _mm_loadu_si128((const __m128i *) (p + 12)), 1);
+                px = _mm256_or_si256(_mm256_shuffle_epi8(px, order), alpha);
+                _mm256_storeu_si256((__m256i *) (c + w), px);
+        }
+        pixel_row_rgb_scalar(p, c + w, width - w);
+}
+
+static bool pixel_cpu_avx2(void)
+{
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+}
+
+static bool pixel_cpu_ssse3(void)
+{
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3");
+}
+
+static bool pixel_cpu_sse2(void)
+{
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+}
+#endif /* PIXEL_KERNELS_X86 */
+
+#ifdef PIXEL_KERNELS_NEON
+static inline uint8x16_t premultiply_neon(uint8x16_t c, uint8x16_t a)
+{
+        uint16x8_t lo = vmlal_u8(vdupq_n_u16(0x80), vget_low_u8(c), vget_low_u8(a));
+        uint16x8_t hi = vmlal_u8(vdupq_n_u16(0x80), vget_high_u8(c), vget_high_u8(a));
+        lo = vsraq_n_u16(lo, lo, 8);
+        hi = vsraq_n_u16(hi, hi, 8);
+        return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+static void pixel_row_rgba_neon(const unsigned char *p, uint32_t *c, int width)
+{
+        int w = 0;
+        for (; w + 16 <= width; w += 16, p += 64) {
+                uint8x16x4_t px = vld4q_u8(p);
+                uint8x16x4_t out;
+                out.val[0] = premultiply_neon(px.val[2], px.val[3]);
+                out.val[1] = premultiply_neon(px.val[1], px.val[3]);
+                out.val[2] = premultiply_neon(px.val[0], px.val[3]);
+                out.val[3] = px.val[3];
+                vst4q_u8((uint8_t *) (c + w), out);
+        }
+        pixel_row_rgba_scalar(p, c + w, width - w);
+}
+
+static void pixel_row_rgb_neon(const unsigned char *p, uint32_t *c, int width)
+{
+        int w = 0;
+        for (; w + 16 <= width; w += 16, p += 48) {
+                uint8x16x3_t px = vld3q_u8(p);
+                uint8x16x4_t out;
+                out.val[0] = px.val[2];
+                out.val[1] = px.val[1];
+                out.val[2] = px.val[0];
+                out.val[3] = vdupq_n_u8(0xff);
+                vst4q_u8((uint8_t *) (c + w), out);
+        }
+        pixel_row_rgb_scalar(p, c + w, width - w);
+}
+#endif /* PIXEL_KERNELS_NEON */
+
+/**
+ * A set of row kernels for one instruction set
+ */
+struct pixel_kernel {
+        const char *name;
+        bool (*supported)(void); /**< Whether the CPU can run it, NULL if always */
+        void (*rgb)(const unsigned char *p, uint32_t *c, int width);
+        void (*rgba)(const unsigned char *p, uint32_t *c, int width);
+};
+
+/** The available kernels, the fastest first */
+static const struct pixel_kernel pixel_kernels[] = {
+#ifdef PIXEL_KERNELS_X86
+        { "avx2",   pixel_cpu_avx2,  pixel_row_rgb_avx2,   pixel_row_rgba_avx2   },
+        { "ssse3",  pixel_cpu_ssse3, pixel_row_rgb_ssse3,  pixel_row_rgba_sse2   },
+        { "sse2",   pixel_cpu_sse2,  pixel_row_rgb_scalar, pixel_row_rgba_sse2   },
+#endif
+#ifdef PIXEL_KERNELS_NEON
+        { "neon",   NULL,            pixel_row_rgb_neon,   pixel_row_rgba_neon   },
+#endif
+        { "scalar", NULL,            pixel_row_rgb_scalar, pixel_row_rgba_scalar },
+};
+
+static bool pixel_kernel_supported(const struct pixel_kernel *kernel)
+{
+        return !kernel->supported || kernel->supported();
+}
+
+/**
+ * Pick the fastest kernel the CPU supports. This is done once and may be
+ * called from the icon loader threads.
+ */
+static const struct pixel_kernel *pixel_kernel_get(void)
+{
+        static const struct pixel_kernel *kernel = NULL;
+
+        if (g_once_init_enter(&kernel)) {
+                const struct pixel_kernel *best = NULL;
+                for (size_t i = 0; i < G_N_ELEMENTS(pixel_kernels) && !best; i++)
+                        if (pixel_kernel_supported(&pixel_kernels[i]))
+                                best = &pixel_kernels[i];
+
+                LOG_D("Converting icons with the %s kernel", best->name);
+                g_once_init_leave(&kernel, best);
+        }
+
+        return kernel;
+}
+
 /**
  * Reassemble the data parts of a GdkPixbuf into a cairo_surface_t's data field.
  *
+ * The rows get converted by the fastest kernel the CPU supports, see
+ * #pixel_kernels.
+ *
  * Requires to call on the surface flush before and mark_dirty after the execution.
  */
 static void pixbuf_data_to_cairo_data(
@@ -32,60 +305,18 @@ static void pixbuf_data_to_cairo_data(
                 int height,
                 int n_channels)
 {
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-        static const size_t CAIRO_B = 0;
-        static const size_t CAIRO_G = 1;
-        static const size_t CAIRO_R = 2;
-        static const size_t CAIRO_A = 3;
-#elif G_BYTE_ORDER == G_BIG_ENDIAN
-        static const size_t CAIRO_A = 0;
-        static const size_t CAIRO_R = 1;
-        static const size_t CAIRO_G = 2;
-        static const size_t CAIRO_B = 3;
-#elif G_BYTE_ORDER == G_PDP_ENDIAN
-        static const size_t CAIRO_R = 0;
-        static const size_t CAIRO_A = 1;
-        static const size_t CAIRO_B = 2;
-        static const size_t CAIRO_G = 3;
-#else
-// GLib doesn't support any other endiannesses
-#error Unsupported Endianness
-#endif
-
         assert(pixels_p);
         assert(pixels_c);
         assert(width > 0);
         assert(height > 0);
+        assert(n_channels == 3 || n_channels == 4);
 
-        if (n_channels == 3) {
-                for (int h = 0; h < height; h++) {
-                              unsigned char *iter_c = pixels_c + h * rowstride_c;
-                        const unsigned char *iter_p = pixels_p + h * rowstride_p;
-                        for (int w = 0; w < width; w++) {
-                                iter_c[CAIRO_R] = iter_p[0];
-                                iter_c[CAIRO_G] = iter_p[1];
-                                iter_c[CAIRO_B] = iter_p[2];
-                                iter_c[CAIRO_A] = 0xff;
-                                iter_c += 4;
-                                iter_p += n_channels;
-                        }
-                }
-        } else {
-                for (int h = 0; h < height; h++) {
-                              unsigned char *iter_c = pixels_c + h * rowstride_c;
-                        const unsigned char *iter_p = pixels_p + h * rowstride_p;
-                        for (int w = 0; w < width; w++) {
-                                double alpha_factor = iter_p[3] / (double)0xff;
-                                iter_c[CAIRO_R] = (unsigned char)(iter_p[0] * alpha_factor + .5);
-                                iter_c[CAIRO_G] = (unsigned char)(iter_p[1] * alpha_factor + .5);
-                                iter_c[CAIRO_B] = (unsigned char)(iter_p[2] * alpha_factor + .5);
-                                iter_c[CAIRO_A] =                 iter_p[3];
-                                iter_c += 4;
-                                iter_p += n_channels;
-                        }
-                }
+        const struct pixel_kernel *kernel = pixel_kernel_get();
+        void (*row)(const unsigned char *, uint32_t *, int) = n_channels == 3 ? kernel->rgb
+                                                                              : kernel->rgba;
 
-        }
+        for (int h = 0; h < height; h++)
+                row(pixels_p + h * rowstride_p, (uint32_t *) (pixels_c + h * rowstride_c), width);
 }
 
 int get_icon_width(cairo_surface_t *icon, double scale) {
@@ -190,22 +421,18 @@ static GdkPixbuf *icon_pixbuf_scale_to_size(GdkPixbuf *pixbuf, double dpi_scale,
 
 static char *get_id_from_data(const uint8_t *data_pb, size_t width, size_t height, size_t pixelstride, size_t rowstride)
 {
-        /* To calculate a checksum of the current image, we have to remove
+        /* To calculate a checksum of the current image, we have to skip
          * all excess spacers, so that our checksummed memory only contains
          * real data. */
 
-        size_t data_chk_len = pixelstride * width * height;
-        unsigned char *data_chk = g_malloc(data_chk_len);
+        GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
         size_t rowstride_short = pixelstride * width;
 
-        for (int i = 0; i < height; i++) {
-                memcpy(data_chk + (i*rowstride_short),
-                       data_pb  + (i*rowstride),
-                       rowstride_short);
-        }
+        for (size_t i = 0; i < height; i++)
+                g_checksum_update(checksum, data_pb + (i*rowstride), rowstride_short);
 
-        char *id = g_compute_checksum_for_data(G_CHECKSUM_MD5, data_chk, data_chk_len);
-        g_free(data_chk);
+        char *id = g_strdup(g_checksum_get_string(checksum));
+        g_checksum_free(checksum);
 
         return id;
 }
@@ -236,6 +463,10 @@ GdkPixbuf *get_pixbuf_from_file(const char *filename, char **id, int min_size, i
                 g_error_free(error);
         }
 
+        // The header may be fine, while the rest of the file is not
+        if (!pixbuf)
+                return NULL;
+
         const uint8_t *data = gdk_pixbuf_get_pixels(pixbuf);
         size_t rowstride = gdk_pixbuf_get_rowstride(pixbuf);
         size_t n_channels = gdk_pixbuf_get_n_channels(pixbuf);
@@ -246,21 +477,26 @@ GdkPixbuf *get_pixbuf_from_file(const char *filename, char **id, int min_size, i
         return pixbuf;
 }
 
-char *get_path_from_icon_name(const char *iconname, int size)
+/** How long an icon name that could not be found is remembered as missing */
+#define ICON_PATH_NEGATIVE_TTL S2US(30)
+
+struct icon_path_entry {
+        char *path;     /**< The resolved path, NULL if the icon was not found */
+        gint64 expires; /**< When a negative entry has to be looked up again */
+};
+
+/** The resolved paths of icon names by size and name */
+static GHashTable *icon_paths = NULL;
+
+static void icon_path_entry_free(struct icon_path_entry *e)
 {
-        if (STR_EMPTY(iconname))
-                return NULL;
+        g_free(e->path);
+        g_free(e);
+}
 
-        if (g_str_has_prefix(iconname, "file://")) {
-                char *uri_path = g_filename_from_uri(iconname, NULL, NULL);
-                if (STR_EMPTY(uri_path)) {
-                        LOG_W("Invalid file uri '%s'", iconname);
-                        return NULL;
-                }
-                return uri_path;
-        } else if (is_like_path(iconname)) {
-                return g_strdup(iconname);
-        } else if (settings.enable_recursive_icon_lookup) {
+static char *find_path_from_icon_name(const char *iconname, int size)
+{
+        if (settings.enable_recursive_icon_lookup) {
                 char *path = find_icon_path(iconname, size);
                 if (STR_EMPTY(path))
                         LOG_W("Icon '%s' not found in themes", iconname);
@@ -304,20 +540,79 @@ char *get_path_from_icon_name(const char *iconname, int size)
         return path;
 }
 
-static void icon_destroy(guchar *pixels, gpointer data)
+char *get_path_from_icon_name(const char *iconname, int size)
 {
-        (void)data;
-        g_free(pixels);
+        if (STR_EMPTY(iconname))
+                return NULL;
+
+        if (g_str_has_prefix(iconname, "file://")) {
+                char *uri_path = g_filename_from_uri(iconname, NULL, NULL);
+                if (STR_EMPTY(uri_path)) {
+                        LOG_W("Invalid file uri '%s'", iconname);
+                        return NULL;
+                }
+                return uri_path;
+        } else if (is_like_path(iconname)) {
+                return g_strdup(iconname);
+        }
+
+        if (!icon_paths)
+                icon_paths = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify) icon_path_entry_free);
+
+        char *key = g_strdup_printf("%d\n%s", size, iconname);
+        struct icon_path_entry *e = g_hash_table_lookup(icon_paths, key);
+        gint64 now = time_monotonic_now();
+
+        if (e && e->path && is_readable_file(e->path)) {
+                g_free(key);
+                return g_strdup(e->path);
+        } else if (e && !e->path && now < e->expires) {
+                LOG_D("Icon '%s' is known to be missing", iconname);
+                g_free(key);
+                return NULL;
+        }
+
+        e = g_malloc(sizeof(struct icon_path_entry));
+        e->path = find_path_from_icon_name(iconname, size);
+        if (STR_EMPTY(e->path))
+                g_clear_pointer(&e->path, g_free);
+        e->expires = now + ICON_PATH_NEGATIVE_TTL;
+        g_hash_table_replace(icon_paths, key, e);
+
+        return g_strdup(e->path);
 }
 
-GdkPixbuf *icon_get_for_data(GVariant *data, char **id, double dpi_scale, int min_size, int max_size)
+void icon_path_cache_clear(void)
 {
-        ASSERT_OR_RET(data, NULL);
-        ASSERT_OR_RET(id, NULL);
+        g_clear_pointer(&icon_paths, g_hash_table_unref);
+}
+
+/**
+ * The pixels of a raw icon, pointing into the GVariant they were sent in
+ */
+struct icon_data {
+        GVariant *pixels;     /**< The referenced byte array of the pixels */
+        const guint8 *data;
+        int width;
+        int height;
+        int rowstride;
+        bool has_alpha;
+        int bits_per_sample;
+        int n_channels;
+        gsize pixelstride;
+};
 
+/**
+ * Unpack and validate the raw icon in data, without copying its pixels.
+ *
+ * @retval false if the data is invalid. img is left empty then.
+ */
+static bool icon_data_parse(GVariant *data, struct icon_data *img)
+{
         if (!STR_EQ("(iiibiiay)", g_variant_get_type_string(data))) {
                 LOG_W("Invalid data for pixbuf given.");
-                return NULL;
+                return false;
         }
 
         /* The raw image is a big array of char data.
@@ -339,75 +634,523 @@ GdkPixbuf *icon_get_for_data(GVariant *data, char **id, double dpi_scale, int mi
          * row n:   |   data for row n    |
          */
 
-        GdkPixbuf *pixbuf = NULL;
-        GVariant *data_variant = NULL;
-        unsigned char *data_pb;
-
-        gsize len_expected;
-        gsize len_actual;
-        gsize pixelstride;
-
-        int width;
-        int height;
-        int rowstride;
-        int has_alpha;
-        int bits_per_sample;
-        int n_channels;
-
+        gboolean has_alpha;
         g_variant_get(data,
                       "(iiibii@ay)",
-                      &width,
-                      &height,
-                      &rowstride,
+                      &img->width,
+                      &img->height,
+                      &img->rowstride,
                       &has_alpha,
-                      &bits_per_sample,
-                      &n_channels,
-                      &data_variant);
+                      &img->bits_per_sample,
+                      &img->n_channels,
+                      &img->pixels);
+        img->has_alpha = has_alpha;
 
         // note: (A+7)/8 rounds up A to the next byte boundary
-        pixelstride = (n_channels * bits_per_sample + 7)/8;
-        len_expected = (height - 1) * rowstride + width * pixelstride;
-        len_actual = g_variant_get_size(data_variant);
+        img->pixelstride = (img->n_channels * img->bits_per_sample + 7)/8;
+        gsize len_expected = (img->height - 1) * img->rowstride + img->width * img->pixelstride;
+        gsize len_actual = g_variant_get_size(img->pixels);
 
-        if (len_actual != len_expected) {
+        if (img->width <= 0 || img->height <= 0 || len_actual != len_expected) {
                 LOG_W("Expected image data to be of length %" G_GSIZE_FORMAT
                       " but got a length of %" G_GSIZE_FORMAT,
                       len_expected,
                       len_actual);
-                g_variant_unref(data_variant);
-                return NULL;
+                g_clear_pointer(&img->pixels, g_variant_unref);
+                return false;
         }
 
-        // g_memdup is deprecated in glib 2.67.4 and higher.
-        // g_memdup2 is a safer alternative
-#if GLIB_CHECK_VERSION(2,67,3)
-        data_pb = (guchar *) g_memdup2(g_variant_get_data(data_variant), len_actual);
-#else
-        data_pb = (guchar *) g_memdup(g_variant_get_data(data_variant), len_actual);
-#endif
+        img->data = g_variant_get_data(img->pixels);
+        return true;
+}
 
-        pixbuf = gdk_pixbuf_new_from_data(data_pb,
-                                          GDK_COLORSPACE_RGB,
-                                          has_alpha,
-                                          bits_per_sample,
-                                          width,
-                                          height,
-                                          rowstride,
-                                          icon_destroy,
-                                          data_pb);
+/**
+ * Wrap the pixels of the raw icon into a pixbuf, which keeps a reference
+ * to them instead of a copy.
+ */
+static GdkPixbuf *icon_data_to_pixbuf(const struct icon_data *img)
+{
+        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(img->data,
+                                                     GDK_COLORSPACE_RGB,
+                                                     img->has_alpha,
+                                                     img->bits_per_sample,
+                                                     img->width,
+                                                     img->height,
+                                                     img->rowstride,
+                                                     (GdkPixbufDestroyNotify) g_variant_unref,
+                                                     g_variant_ref(img->pixels));
         if (!pixbuf) {
                 /* Dear user, I'm sorry, I'd like to give you a more specific
                  * error message. But sadly, I can't */
                 LOG_W("Cannot serialise raw icon data into pixbuf.");
+                g_variant_unref(img->pixels);
+        }
+        return pixbuf;
+}
+
+GdkPixbuf *icon_get_for_data(GVariant *data, char **id, double dpi_scale, int min_size, int max_size)
+{
+        ASSERT_OR_RET(data, NULL);
+        ASSERT_OR_RET(id, NULL);
+
+        struct icon_data img;
+        if (!icon_data_parse(data, &img))
                 return NULL;
+
+        GdkPixbuf *pixbuf = icon_data_to_pixbuf(&img);
+        if (pixbuf) {
+                *id = get_id_from_data(img.data, img.width, img.height, img.pixelstride, img.rowstride);
+                pixbuf = icon_pixbuf_scale_to_size(pixbuf, dpi_scale, min_size, max_size);
         }
 
+        g_variant_unref(img.pixels);
+        return pixbuf;
+}
 
-        *id = get_id_from_data(data_pb, width, height, pixelstride, rowstride);
+/**
+ * Downscale the raw icon to width x height straight into a new cairo
+ * surface, like gdk_pixbuf_to_cairo_surface() on the scaled pixbuf would
+ * produce. Each target pixel is the area weighted average of the source
+ * pixels it covers, premultiplied by alpha on the fly.
+ *
+ * Only 8 bit RGB and RGBA sources, which are not smaller than the target,
+ * are supported.
+ *
+ * @retval NULL if the source is not supported
+ */
+static cairo_surface_t *icon_data_scale_to_surface(const struct icon_data *img, int width, int height)
+{
+        if (img->bits_per_sample != 8
+            || img->n_channels != (img->has_alpha ? 4 : 3)
+            || width <= 0 || height <= 0
+            || width > img->width || height > img->height)
+                return NULL;
 
-        g_variant_unref(data_variant);
+        cairo_format_t fmt = img->has_alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+        cairo_surface_t *surface = cairo_image_surface_create(fmt, width, height);
+        if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+                cairo_surface_destroy(surface);
+                return NULL;
+        }
 
-        pixbuf = icon_pixbuf_scale_to_size(pixbuf, dpi_scale, min_size, max_size);
+        const double scale_x = (double) img->width / width;
+        const double scale_y = (double) img->height / height;
+        const int stride = cairo_image_surface_get_stride(surface);
 
-        return pixbuf;
+        cairo_surface_flush(surface);
+        unsigned char *dst = cairo_image_surface_get_data(surface);
+
+        for (int y = 0; y < height; y++) {
+                double y0 = y * scale_y, y1 = (y + 1) * scale_y;
+                int sy_end = MIN((int) ceil(y1), img->height);
+                uint32_t *row = (uint32_t *) (dst + (size_t) y * stride);
+
+                for (int x = 0; x < width; x++) {
+                        double x0 = x * scale_x, x1 = (x + 1) * scale_x;
+                        int sx_end = MIN((int) ceil(x1), img->width);
+                        double r = 0, g = 0, b = 0, a = 0;
+
+                        for (int sy = (int) y0; sy < sy_end; sy++) {
+                                double wy = MIN(sy + 1, y1) - MAX(sy, y0);
+                                const guint8 *p = img->data + (size_t) sy * img->rowstride
+                                                + (size_t) x0 * img->pixelstride;
+
+                                for (int sx = (int) x0; sx < sx_end; sx++, p += img->pixelstride) {
+                                        double w = wy * (MIN(sx + 1, x1) - MAX(sx, x0));
+                                        if (img->has_alpha) {
+                                                double wa = w * p[3];
+                                                r += wa * p[0];
+                                                g += wa * p[1];
+                                                b += wa * p[2];
+                                                a += wa;
+                                        } else {
+                                                r += w * p[0];
+                                                g += w * p[1];
+                                                b += w * p[2];
+                                        }
+                                }
+                        }
+
+                        double area = scale_x * scale_y;
+                        uint32_t pa = 0xff;
+                        if (img->has_alpha) {
+                                // The channels are weighted by alpha already
+                                area *= 0xff;
+                                pa = (uint32_t) (a / scale_x / scale_y + .5);
+                        }
+                        row[x] = pa << 24
+                               | (uint32_t) (r / area + .5) << 16
+                               | (uint32_t) (g / area + .5) << 8
+                               | (uint32_t) (b / area + .5);
+                }
+        }
+
+        cairo_surface_mark_dirty(surface);
+        return surface;
+}
+
+/**
+ * A decoded icon in the icon cache
+ */
+struct icon_cache_entry {
+        char *key;
+        char *id;
+        cairo_surface_t *surface;
+        gsize size;
+};
+
+static struct {
+        GHashTable *entries; /**< The GList links in #lru by their key */
+        GQueue lru;          /**< The entries, most recently used first */
+        gsize size;          /**< Bytes of pixel data of all cached surfaces */
+        guint64 hits;
+        guint64 misses;
+} icon_cache = { .lru = G_QUEUE_INIT };
+
+static gsize icon_cache_budget(void)
+{
+        return settings.icon_cache_size > 0 ? (gsize) settings.icon_cache_size * 1024 : 0;
+}
+
+static void icon_cache_entry_free(struct icon_cache_entry *e)
+{
+        cairo_surface_destroy(e->surface);
+        g_free(e->key);
+        g_free(e->id);
+        g_free(e);
+}
+
+/**
+ * Drop the least recently used entries until the cache fits into budget
+ * bytes. Notifications keep their own references to the surfaces.
+ */
+static void icon_cache_trim(gsize budget)
+{
+        while (icon_cache.size > budget && icon_cache.lru.tail) {
+                struct icon_cache_entry *e = g_queue_pop_tail(&icon_cache.lru);
+                g_hash_table_remove(icon_cache.entries, e->key);
+                icon_cache.size -= e->size;
+                icon_cache_entry_free(e);
+        }
+}
+
+/**
+ * Like icon_cache_lookup(), but without counting a hit or miss. For
+ * lookups that only take the icon if it happens to be cached.
+ */
+static cairo_surface_t *icon_cache_peek(const char *key, char **id)
+{
+        GList *link = icon_cache.entries ? g_hash_table_lookup(icon_cache.entries, key) : NULL;
+        if (!link)
+                return NULL;
+
+        g_queue_unlink(&icon_cache.lru, link);
+        g_queue_push_head_link(&icon_cache.lru, link);
+
+        struct icon_cache_entry *e = link->data;
+        *id = g_strdup(e->id);
+        return cairo_surface_reference(e->surface);
+}
+
+/**
+ * @return (transfer full) the cached surface of key
+ * @retval NULL if key is not cached
+ */
+static cairo_surface_t *icon_cache_lookup(const char *key, char **id)
+{
+        cairo_surface_t *surface = icon_cache_peek(key, id);
+        if (surface)
+                icon_cache.hits++;
+        else
+                icon_cache.misses++;
+        return surface;
+}
+
+static void icon_cache_insert(const char *key, const char *id, cairo_surface_t *surface)
+{
+        gsize budget = icon_cache_budget();
+        gsize size = (gsize) cairo_image_surface_get_stride(surface)
+                   * cairo_image_surface_get_height(surface);
+
+        if (size > budget) {
+                // Apply a lowered budget anyway
+                icon_cache_trim(budget);
+                return;
+        }
+
+        icon_cache_trim(budget - size);
+
+        if (!icon_cache.entries)
+                icon_cache.entries = g_hash_table_new(g_str_hash, g_str_equal);
+
+        struct icon_cache_entry *e = g_malloc(sizeof(struct icon_cache_entry));
+        e->key = g_strdup(key);
+        e->id = g_strdup(id);
+        e->surface = cairo_surface_reference(surface);
+        e->size = size;
+
+        g_queue_push_head(&icon_cache.lru, e);
+        g_hash_table_insert(icon_cache.entries, e->key, icon_cache.lru.head);
+        icon_cache.size += size;
+}
+
+/**
+ * @return (transfer full) the cache key of the file
+ * @retval NULL if the file does not exist
+ */
+static char *icon_file_cache_key(const char *filename, int min_size, int max_size, double scale)
+{
+        // Include the modification time, so edited files get loaded again
+        GStatBuf statbuf;
+        if (g_stat(filename, &statbuf) != 0)
+                return NULL;
+
+        return g_strdup_printf("file\n%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT "\n%d\n%d\n%g",
+                               filename, (gint64) statbuf.st_mtime, (gint64) statbuf.st_size,
+                               min_size, max_size, scale);
+}
+
+cairo_surface_t *icon_surface_from_file(const char *filename, char **id, int min_size, int max_size, double scale)
+{
+        ASSERT_OR_RET(filename, NULL);
+        ASSERT_OR_RET(id, NULL);
+
+        char *key = icon_file_cache_key(filename, min_size, max_size, scale);
+        cairo_surface_t *surface = key ? icon_cache_lookup(key, id) : NULL;
+        if (surface) {
+                g_free(key);
+                return surface;
+        }
+
+        GdkPixbuf *pixbuf = get_pixbuf_from_file(filename, id, min_size, max_size, scale);
+        if (pixbuf) {
+                surface = gdk_pixbuf_to_cairo_surface(pixbuf);
+                g_object_unref(pixbuf);
+        }
+
+        if (surface && key)
+                icon_cache_insert(key, *id, surface);
+
+        g_free(key);
+        return surface;
+}
+
+/** The number of threads decoding icon files */
+#define ICON_LOADER_THREADS 2
+
+/**
+ * A file decoded by the icon loader threads. The job belongs to the thread
+ * decoding it until it gets handed back to the main loop.
+ */
+struct icon_load_job {
+        char *filename;
+        char *key;        /**< The cache key, NULL if the file could not be stat'ed */
+        int min_size;
+        int max_size;
+        double scale;
+        GSList *waiters;  /**< The icon_load_waiter to notify, in order of request */
+
+        cairo_surface_t *surface;
+        char *id;
+};
+
+struct icon_load_waiter {
+        icon_loaded_cb callback;
+        gpointer user_data;
+};
+
+static struct {
+        GThreadPool *pool;
+        GHashTable *pending; /**< The jobs with a cache key by their key */
+        GQueue jobs;         /**< All jobs not handed back to the main loop yet */
+} icon_loader;
+
+static void icon_load_job_free(struct icon_load_job *job)
+{
+        if (job->surface)
+                cairo_surface_destroy(job->surface);
+        g_slist_free_full(job->waiters, g_free);
+        g_free(job->filename);
+        g_free(job->key);
+        g_free(job->id);
+        g_free(job);
+}
+
+static gboolean icon_load_job_done(gpointer data)
+{
+        struct icon_load_job *job = data;
+
+        g_queue_remove(&icon_loader.jobs, job);
+        if (job->key) {
+                g_hash_table_remove(icon_loader.pending, job->key);
+                if (job->surface)
+                        icon_cache_insert(job->key, job->id, job->surface);
+        }
+
+        if (!job->surface)
+                LOG_W("Failed to load icon from path: '%s'", job->filename);
+
+        for (GSList *iter = job->waiters; iter; iter = iter->next) {
+                struct icon_load_waiter *w = iter->data;
+                w->callback(job->surface, job->id, w->user_data);
+        }
+
+        icon_load_job_free(job);
+        return G_SOURCE_REMOVE;
+}
+
+static void icon_load_job_run(gpointer data, gpointer user_data)
+{
+        (void)user_data;
+        struct icon_load_job *job = data;
+
+        GdkPixbuf *pixbuf = get_pixbuf_from_file(job->filename, &job->id,
+                                                 job->min_size, job->max_size, job->scale);
+        if (pixbuf) {
+                job->surface = gdk_pixbuf_to_cairo_surface(pixbuf);
+                g_object_unref(pixbuf);
+        }
+
+        g_idle_add(icon_load_job_done, job);
+}
+
+cairo_surface_t *icon_surface_from_file_async(const char *filename, char **id,
+                                              int min_size, int max_size, double scale,
+                                              icon_loaded_cb callback, gpointer user_data)
+{
+        ASSERT_OR_RET(filename, NULL);
+        ASSERT_OR_RET(id, NULL);
+
+        char *key = icon_file_cache_key(filename, min_size, max_size, scale);
+        cairo_surface_t *surface = NULL;
+        if (key)
+                surface = callback ? icon_cache_lookup(key, id) : icon_cache_peek(key, id);
+        if (surface || !callback) {
+                g_free(key);
+                return surface;
+        }
+
+        struct icon_load_waiter *w = g_malloc(sizeof(struct icon_load_waiter));
+        w->callback = callback;
+        w->user_data = user_data;
+
+        if (!icon_loader.pending)
+                icon_loader.pending = g_hash_table_new(g_str_hash, g_str_equal);
+
+        // Somebody else is already waiting for this file
+        struct icon_load_job *job = key ? g_hash_table_lookup(icon_loader.pending, key) : NULL;
+        if (job) {
+                job->waiters = g_slist_append(job->waiters, w);
+                g_free(key);
+                return NULL;
+        }
+
+        job = g_malloc0(sizeof(struct icon_load_job));
+        job->filename = g_strdup(filename);
+        job->key = key;
+        job->min_size = min_size;
+        job->max_size = max_size;
+        job->scale = scale;
+        job->waiters = g_slist_append(NULL, w);
+        if (key)
+                g_hash_table_insert(icon_loader.pending, key, job);
+        g_queue_push_tail(&icon_loader.jobs, job);
+
+        if (!icon_loader.pool) {
+                GError *err = NULL;
+                icon_loader.pool = g_thread_pool_new(icon_load_job_run, NULL,
+                                                     ICON_LOADER_THREADS, FALSE, &err);
+                if (err) {
+                        LOG_W("Cannot start icon loader threads: %s", err->message);
+                        g_error_free(err);
+                }
+        }
+
+        // Without threads the callback still has to run from the main loop
+        if (!icon_loader.pool || !g_thread_pool_push(icon_loader.pool, job, NULL))
+                icon_load_job_run(job, NULL);
+
+        return NULL;
+}
+
+void icon_loader_teardown(void)
+{
+        // Jobs not yet started are dropped, the running ones are waited for
+        if (icon_loader.pool)
+                g_thread_pool_free(icon_loader.pool, TRUE, TRUE);
+        icon_loader.pool = NULL;
+        g_clear_pointer(&icon_loader.pending, g_hash_table_unref);
+
+        /* Neither the dropped nor the finished jobs get handed back to the
+         * main loop anymore. Their waiters get told the load failed, so
+         * they can release what they hold. */
+        struct icon_load_job *job;
+        while ((job = g_queue_pop_head(&icon_loader.jobs))) {
+                g_idle_remove_by_data(job);
+                for (GSList *iter = job->waiters; iter; iter = iter->next) {
+                        struct icon_load_waiter *w = iter->data;
+                        w->callback(NULL, NULL, w->user_data);
+                }
+                icon_load_job_free(job);
+        }
+}
+
+cairo_surface_t *icon_surface_from_data(GVariant *data, char **id, double dpi_scale, int min_size, int max_size)
+{
+        ASSERT_OR_RET(data, NULL);
+        ASSERT_OR_RET(id, NULL);
+
+        struct icon_data img;
+        if (!icon_data_parse(data, &img))
+                return NULL;
+
+        char *data_id = get_id_from_data(img.data, img.width, img.height, img.pixelstride, img.rowstride);
+        char *key = g_strdup_printf("data\n%s\n%d\n%d\n%g", data_id, min_size, max_size, dpi_scale);
+
+        cairo_surface_t *surface = icon_cache_lookup(key, id);
+        if (surface)
+                goto out;
+
+        // Same size as icon_pixbuf_scale_to_size() would scale to
+        int w = img.width, h = img.height;
+        if (icon_size_clamp(&w, &h, min_size, max_size)) {
+                w = round(w * dpi_scale);
+                h = round(h * dpi_scale);
+        }
+
+        surface = icon_data_scale_to_surface(&img, w, h);
+        if (!surface) {
+                // Scaling up, or an unusual format
+                GdkPixbuf *pixbuf = icon_data_to_pixbuf(&img);
+                if (pixbuf) {
+                        pixbuf = icon_pixbuf_scale_to_size(pixbuf, dpi_scale, min_size, max_size);
+                        surface = gdk_pixbuf_to_cairo_surface(pixbuf);
+                        g_object_unref(pixbuf);
+                }
+        }
+
+        if (surface) {
+                *id = g_strdup(data_id);
+                icon_cache_insert(key, data_id, surface);
+        }
+
+out:
+        g_variant_unref(img.pixels);
+        g_free(data_id);
+        g_free(key);
+        return surface;
+}
+
+void icon_cache_get_stats(struct icon_cache_stats *stats)
+{
+        stats->hits = icon_cache.hits;
+        stats->misses = icon_cache.misses;
+        stats->size = icon_cache.size;
+        stats->entries = icon_cache.lru.length;
+}
+
+void icon_cache_clear(void)
+{
+        icon_cache_trim(0);
+        g_clear_pointer(&icon_cache.entries, g_hash_table_unref);
 }
@@ -53,11 +53,20 @@ int get_icon_height(cairo_surface_t *icon, double scale);
  * @param size     Size of the icon to look for. This is only used when
  *                 recursive icon lookup is enabled.
  *
+ * The resolved paths of icon names are cached, names which could not be
+ * found only for a while.
+ *
  * @return a newly allocated string with the icon path
  * @retval NULL when file does not exist, not readable, etc..
  */
 char *get_path_from_icon_name(const char *iconname, int size);
 
+/**
+ * Forget the resolved paths of all icon names, e.g. after the icon_path
+ * or the icon themes changed.
+ */
+void icon_path_cache_clear(void);
+
 /** Convert a GVariant like described in GdkPixbuf, scaled according to settings
  *
  * The returned id will be a unique identifier. To check if two given
@@ -75,4 +84,78 @@ char *get_path_from_icon_name(const char *iconname, int size);
  */
 GdkPixbuf *icon_get_for_data(GVariant *data, char **id, double dpi_scale, int min_size, int max_size);
 
+/** Retrieve the surface of an icon by its full filepath, like
+ * get_pixbuf_from_file().
+ *
+ * The surfaces are cached by path, modification time, size limits and scale
+ * within the memory budget of the icon_cache_size setting. Cached surfaces
+ * are shared, so they must not be modified.
+ *
+ * @return (transfer full) the icon surface
+ * @retval NULL when file does not exist, not readable, etc..
+ */
+cairo_surface_t *icon_surface_from_file(const char *filename, char **id, int min_size, int max_size, double scale);
+
+/**
+ * Called from the main loop, when the icon file requested with
+ * icon_surface_from_file_async() got decoded.
+ *
+ * @param icon (transfer none) the icon surface, NULL if it could not be loaded
+ * @param id   (transfer none) the id of the icon
+ * @param user_data The data given to icon_surface_from_file_async()
+ */
+typedef void (*icon_loaded_cb)(cairo_surface_t *icon, const char *id, gpointer user_data);
+
+/** Retrieve the surface of an icon file like icon_surface_from_file(), but
+ * decode it in one of the icon loader threads if it is not cached yet.
+ *
+ * Concurrent requests for the same file share one decode and their
+ * callbacks are called in the order of the requests.
+ *
+ * @param callback Called once the icon is decoded. If NULL, only the cache
+ *                 is looked into, without counting as a hit or miss.
+ *
+ * @return (transfer full) the icon surface, if it is cached. The callback
+ *         is not called then.
+ * @retval NULL if the icon is being decoded or callback is NULL
+ */
+cairo_surface_t *icon_surface_from_file_async(const char *filename, char **id,
+                                              int min_size, int max_size, double scale,
+                                              icon_loaded_cb callback, gpointer user_data);
+
+/**
+ * Stop the icon loader threads. Decodes not yet started are dropped. The
+ * callbacks of all loads not finished yet get called right away with a
+ * NULL icon.
+ */
+void icon_loader_teardown(void);
+
+/** Retrieve the surface of a raw icon, like icon_get_for_data().
+ *
+ * The surfaces are cached by the id of the data, size limits and scale, see
+ * icon_surface_from_file(). 8 bit images are downscaled straight from the
+ * data of the GVariant into the surface, without intermediate copies.
+ *
+ * @return (transfer full) the icon surface
+ * @retval NULL when GVariant parameter is NULL, invalid or in wrong format
+ */
+cairo_surface_t *icon_surface_from_data(GVariant *data, char **id, double dpi_scale, int min_size, int max_size);
+
+/**
+ * Statistics of the icon cache
+ */
+struct icon_cache_stats {
+        guint64 hits;
+        guint64 misses;
+        gsize size;     /**< Bytes of pixel data of the cached surfaces */
+        guint entries;
+};
+
+void icon_cache_get_stats(struct icon_cache_stats *stats);
+
+/**
+ * Drop all icons from the cache. Surfaces used by notifications stay valid.
+ */
+void icon_cache_clear(void);
+
 #endif
@@ -113,12 +113,14 @@ void input_handle_click(unsigned int button, bool button_down, int mouse_x, int
                         if (n) {
                                 if (act == MOUSE_CLOSE_CURRENT) {
                                         n->marked_for_closure = REASON_USER;
+                                        queues_check_all();
                                 } else if (act == MOUSE_DO_ACTION) {
                                         notification_do_action(n);
                                 } else if (act == MOUSE_OPEN_URL) {
                                         notification_open_url(n);
                                 } else if (act == MOUSE_REMOVE_CURRENT) {
                                         n->marked_for_removal = REASON_USER;
+                                        queues_check_all();
                                 } else {
                                         notification_open_context_menu(n);
                                 }
@@ -7,14 +7,12 @@
  */
 
 #include <assert.h>
-#include <errno.h>
 #include <glib.h>
 #include <libgen.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -26,6 +24,7 @@
 #include "markup.h"
 #include "menu.h"
 #include "queues.h"
+#include "script.h"
 #include "utils.h"
 #include "draw.h"
 #include "icon-lookup.h"
@@ -130,63 +129,11 @@ void notification_run_script(struct notification *n)
 
         n->script_run = true;
 
-        const char *appname = n->appname ? n->appname : "";
-        const char *summary = n->summary ? n->summary : "";
-        const char *body = n->body ? n->body : "";
-        const char *icon = n->iconname ? n->iconname : "";
-
-        const char *urgency = notification_urgency_to_string(n->urgency);
-
         for(int i = 0; i < n->script_count; i++) {
-
-                const char *script = n->scripts[i];
-
-                if (STR_EMPTY(script))
+                if (STR_EMPTY(n->scripts[i]))
                         continue;
 
-                int pid1 = fork();
-
-                if (pid1) {
-                        int status;
-                        waitpid(pid1, &status, 0);
-                } else {
-                        // second fork to prevent zombie processes
-                        int pid2 = fork();
-                        if (pid2) {
-                                exit(0);
-                        } else {
-                                // Set environment variables
-                                gchar *n_id_str = g_strdup_printf("%i", n->id);
-                                gchar *n_progress_str = g_strdup_printf("%i", n->progress);
-                                gchar *n_timeout_str = g_strdup_printf("%"G_GINT64_FORMAT, n->timeout/1000);
-                                gchar *n_timestamp_str = g_strdup_printf("%"G_GINT64_FORMAT, n->timestamp / 1000);
-                                safe_setenv("DUNST_APP_NAME",  appname);
-                                safe_setenv("DUNST_SUMMARY",   summary);
-                                safe_setenv("DUNST_BODY",      body);
-                                safe_setenv("DUNST_ICON_PATH", n->icon_path);
-                                safe_setenv("DUNST_URGENCY",   urgency);
-                                safe_setenv("DUNST_ID",        n_id_str);
-                                safe_setenv("DUNST_PROGRESS",  n_progress_str);
-                                safe_setenv("DUNST_CATEGORY",  n->category);
-                                safe_setenv("DUNST_STACK_TAG", n->stack_tag);
-                                safe_setenv("DUNST_URLS",      n->urls);
-                                safe_setenv("DUNST_TIMEOUT",   n_timeout_str);
-                                safe_setenv("DUNST_TIMESTAMP", n_timestamp_str);
-                                safe_setenv("DUNST_DESKTOP_ENTRY", n->desktop_entry);
-
-                                execlp(script,
-                                                script,
-                                                appname,
-                                                summary,
-                                                body,
-                                                icon,
-                                                urgency,
-                                                (char *)NULL);
-
-                                LOG_W("Unable to run script %s: %s", n->scripts[i], strerror(errno));
-                                exit(EXIT_FAILURE);
-                        }
-                }
+                script_run(n->scripts[i], n);
         }
 }
 
@@ -337,6 +284,8 @@ void notification_unref(struct notification *n)
 
         g_free(n->msg);
         g_free(n->text_to_render);
+        g_free(n->age_to_render);
+        draw_layout_cache_free(n->layout_cache);
         g_free(n->urls);
 
         g_free(n);
@@ -344,6 +293,13 @@ void notification_unref(struct notification *n)
 
 void notification_transfer_icon(struct notification *from, struct notification *to)
 {
+        // The pending load belongs to the old notification, the new one has
+        // to load the icon itself
+        if (from->icon_load)
+                return;
+
+        to->icon_load = 0;
+
         // Transfer icon surface
         to->icon = from->icon;
         to->icon_id = from->icon_id;
@@ -371,21 +327,103 @@ void notification_icon_replace_path(struct notification *n, const char *new_icon
         cairo_surface_destroy(n->icon);
         n->icon = NULL;
         g_clear_pointer(&n->icon_id, g_free);
+        n->icon_load = 0;
 
         g_free(n->icon_path);
         n->icon_path = get_path_from_icon_name(new_icon, n->min_icon_size);
         if (n->icon_path) {
-                GdkPixbuf *pixbuf = get_pixbuf_from_file(n->icon_path, &n->icon_id,
+                n->icon = icon_surface_from_file(n->icon_path, &n->icon_id,
                                 n->min_icon_size, n->max_icon_size,
                                 draw_get_scale());
-                if (pixbuf) {
-                        n->icon = gdk_pixbuf_to_cairo_surface(pixbuf);
+                if (n->icon)
                         n->icon_time = time_now();
-                        g_object_unref(pixbuf);
-                } else {
+                else
                         LOG_W("Failed to load icon from path: '%s'", n->icon_path);
+        }
+}
+
+/** The id of the last asynchronous icon load */
+static guint icon_load_last = 0;
+
+struct notification_icon_load {
+        struct notification *n;
+        guint id;
+};
+
+static void notification_icon_loaded(cairo_surface_t *icon, const char *id, gpointer data)
+{
+        struct notification_icon_load *load = data;
+        struct notification *n = load->n;
+
+        // Drop the icon, if it got replaced meanwhile
+        if (n->icon_load == load->id) {
+                n->icon_load = 0;
+                if (icon) {
+                        cairo_surface_destroy(n->icon);
+                        n->icon = cairo_surface_reference(icon);
+                        g_free(n->icon_id);
+                        n->icon_id = g_strdup(id);
+                        n->icon_time = time_now();
+                        wake_up();
                 }
         }
+
+        notification_unref(n);
+        g_free(load);
+}
+
+void notification_icon_load_path(struct notification *n, const char *new_icon)
+{
+        ASSERT_OR_RET(n && n->icon_position != ICON_OFF,);
+        ASSERT_OR_RET(new_icon,);
+
+        // make sure it works, even if n->iconname is passed as new_icon
+        if (n->iconname != new_icon) {
+                g_free(n->iconname);
+                n->iconname = g_strdup(new_icon);
+        }
+
+        cairo_surface_destroy(n->icon);
+        n->icon = NULL;
+        g_clear_pointer(&n->icon_id, g_free);
+        n->icon_load = 0;
+
+        g_free(n->icon_path);
+        n->icon_path = get_path_from_icon_name(new_icon, n->min_icon_size);
+        if (!n->icon_path)
+                return;
+
+        struct notification_icon_load *load = g_malloc(sizeof(struct notification_icon_load));
+        load->n = n;
+        if (++icon_load_last == 0)
+                icon_load_last++;
+        load->id = icon_load_last;
+
+        n->icon = icon_surface_from_file_async(n->icon_path, &n->icon_id,
+                        n->min_icon_size, n->max_icon_size, draw_get_scale(),
+                        notification_icon_loaded, load);
+        if (n->icon) {
+                n->icon_time = time_now();
+                g_free(load);
+                return;
+        }
+
+        notification_ref(n);
+        n->icon_load = load->id;
+
+        // Show the default icon meanwhile, but only if it is decoded already
+        const char *placeholder = n->default_icon_name ? n->default_icon_name
+                                                       : settings.icons[n->urgency];
+        if (STR_FULL(placeholder) && !STR_EQ(placeholder, new_icon)) {
+                char *path = get_path_from_icon_name(placeholder, n->min_icon_size);
+                char *id = NULL;
+                if (path)
+                        n->icon = icon_surface_from_file_async(path, &id,
+                                        n->min_icon_size, n->max_icon_size, draw_get_scale(),
+                                        NULL, NULL);
+                g_free(id);
+                g_free(path);
+        }
 }
 
 void notification_icon_replace_data(struct notification *n, GVariant *new_icon)
@@ -396,14 +434,12 @@ void notification_icon_replace_data(struct notification *n, GVariant *new_icon)
         cairo_surface_destroy(n->icon);
         n->icon = NULL;
         g_clear_pointer(&n->icon_id, g_free);
+        n->icon_load = 0;
 
-        GdkPixbuf *icon = icon_get_for_data(new_icon, &n->icon_id,
+        n->icon = icon_surface_from_data(new_icon, &n->icon_id,
                         draw_get_scale(), n->min_icon_size, n->max_icon_size);
-        n->icon = gdk_pixbuf_to_cairo_surface(icon);
-        if (icon) {
+        if (n->icon)
                 n->icon_time = time_now();
-                g_object_unref(icon);
-        }
 }
 
 void notification_replace_format(struct notification *n, const char *format)
@@ -714,6 +750,7 @@ static void notification_extract_urls(struct notification *n)
 void notification_update_text_to_render(struct notification *n)
 {
         g_clear_pointer(&n->text_to_render, g_free);
+        g_clear_pointer(&n->age_to_render, g_free);
 
         char *buf = NULL;
 
@@ -747,20 +784,18 @@ void notification_update_text_to_render(struct notification *n)
                 minutes = US2S(t_delta) / 60 % 60;
                 seconds = US2S(t_delta) % 60;
 
-                char *new_buf;
+                // Kept apart, so the text does not change every second.
+                // It gets drawn right after it, hence the leading space.
                 if (hours > 0) {
-                        new_buf = g_strdup_printf("%s (%"G_GINT64_FORMAT"h %"G_GINT64_FORMAT"m %"G_GINT64_FORMAT"s old)",
-                                                  buf, hours, minutes, seconds);
+                        n->age_to_render = g_strdup_printf(" (%"G_GINT64_FORMAT"h %"G_GINT64_FORMAT"m %"G_GINT64_FORMAT"s old)",
+                                                           hours, minutes, seconds);
                 } else if (minutes > 0) {
-                        new_buf = g_strdup_printf("%s (%"G_GINT64_FORMAT"m %"G_GINT64_FORMAT"s old)",
-                                                  buf, minutes, seconds);
+                        n->age_to_render = g_strdup_printf(" (%"G_GINT64_FORMAT"m %"G_GINT64_FORMAT"s old)",
+                                                           minutes, seconds);
                 } else {
-                        new_buf = g_strdup_printf("%s (%"G_GINT64_FORMAT"s old)",
-                                                  buf, seconds);
+                        n->age_to_render = g_strdup_printf(" (%"G_GINT64_FORMAT"s old)",
+                                                           seconds);
                 }
-
-                g_free(buf);
-                buf = new_buf;
         }
 
         n->text_to_render = buf;
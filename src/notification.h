@@ -84,9 +84,11 @@ struct notification {
         int max_icon_size; /**< Maximum icon size. */
         enum icon_position icon_position;       /**< Icon position (enum left,right,top,off). */
         bool receiving_raw_icon; /**< Still waiting for raw icon to be received */
+        guint icon_load;         /**< The pending asynchronous load of the icon, 0 if none */
 
         gint64 start;      /**< begin of current display (in milliseconds) */
         gint64 timestamp;  /**< arrival time (in milliseconds) */
+        gint64 history_time; /**< time of being pushed to the history, ascending in it */
         gint64 timeout;    /**< time to display (in milliseconds) */
         gint64 dbus_timeout; /**< time to display (in milliseconds) (set by dbus) */
         int locked;     /**< If non-zero the notification is locked **/
@@ -125,7 +127,9 @@ struct notification {
 
         /* derived fields */
         char *msg;            /**< formatted message */
-        char *text_to_render; /**< formatted message (with age and action indicators) */
+        char *text_to_render; /**< formatted message (with action indicators) */
+        char *age_to_render;  /**< age of the notification, NULL if it is not shown */
+        struct layout_cache *layout_cache; /**< The shaped text_to_render, owned by draw.c */
         char *urls;           /**< urllist delimited by '\\n' */
 };
 
@@ -205,6 +209,20 @@ void notification_transfer_icon(struct notification *from, struct notification *
  */
 void notification_icon_replace_path(struct notification *n, const char *new_icon);
 
+/**Replace the current notification's icon like notification_icon_replace_path(),
+ * but decode the icon file in the background if it is not cached.
+ *
+ * Until the icon is loaded, the notification shows the default icon if that
+ * is cached, or no icon at all. A later replacement or transfer of the icon
+ * takes precedence over the pending load.
+ *
+ * @post wake_up() is called, when the icon got loaded
+ *
+ * @param n the notification to replace the icon
+ * @param new_icon The path of the new icon. May be an absolute path or an icon name.
+ */
+void notification_icon_load_path(struct notification *n, const char *new_icon);
+
 /**Replace the current notification's icon with the raw icon given in the GVariant.
  *
  * Removes the reference for the previous icon automatically.
@@ -501,6 +501,11 @@ bool set_rule(struct setting setting, char* value, char* section) {
                 r = rule_new(section);
                 LOG_D("Creating new rule '%s'", section);
         }
+
+        // The compiled filters are stale now
+        if (rule_offset_is_filter(setting.rule_offset))
+                rule_invalidate(r);
+
         return set_rule_value(r, setting, value);
 }
 
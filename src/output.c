@@ -34,6 +34,7 @@ const struct output output_x11 = {
         x_win_hide,
 
         x_display_surface,
+        x_win_get_buffer,
         x_win_get_context,
 
         get_active_screen,
@@ -57,6 +58,7 @@ const struct output output_wl = {
         wl_win_hide,
 
         wl_display_surface,
+        wl_win_get_buffer,
         wl_win_get_context,
 
         wl_get_active_screen,
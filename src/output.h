@@ -25,6 +25,9 @@ struct dimensions {
         int text_height;
 
         int corner_radius;
+
+        /** The changed part of the surface in scaled pixels, NULL if all of it changed */
+        const cairo_region_t *damage;
 };
 
 struct screen_info {
@@ -50,6 +53,14 @@ struct output {
 
         void (*display_surface)(cairo_surface_t *srf, window win, const struct dimensions*);
 
+        /**
+         * Get the surface of the buffer to render the next frame of the
+         * given size (in scaled pixels) into, to be passed to
+         * display_surface() afterwards. Returns NULL if the output has no
+         * buffer to render into directly.
+         */
+        cairo_surface_t* (*win_get_buffer)(window win, int width, int height);
+
         cairo_t* (*win_get_context)(window);
 
         const struct screen_info* (*get_active_screen)(void);
@@ -12,7 +12,9 @@
 #include <string.h>
 
 #include "queues.h"
+#include "draw.h"
 #include "dunst.h"
+#include "history_log.h"
 #include "log.h"
 #include "notification.h"
 #include "settings.h"
@@ -24,16 +26,112 @@ static GQueue *waiting   = NULL; /**< all new notifications get into here */
 static GQueue *displayed = NULL; /**< currently displayed notifications */
 static GQueue *history   = NULL; /**< history of displayed notifications */
 
+/**
+ * The position of a notification in one of the queues
+ */
+struct queue_entry {
+        GQueue *queue;
+        GList *link;
+};
+
+/**
+ * All queued notifications by their id, so they can be found without walking
+ * the queues. Maps the id to a GQueue of struct queue_entry, as the same id
+ * may be in history and in displayed or waiting at once (e.g. when a new
+ * notification replaces a closed one).
+ *
+ * Every change to the queues has to go through the queues_link_* helpers to
+ * keep this and the indices below in sync.
+ */
+static GHashTable *ids = NULL;
+
+/**
+ * Displayed and waiting notifications by a hash of their appname and
+ * stack_tag, see queues_stack_by_tag(). Same layout as #ids.
+ */
+static GHashTable *stack_tags = NULL;
+
+/**
+ * Displayed and waiting notifications by a hash of the fields compared by
+ * notification_is_duplicate(), see queues_stack_duplicate(). Same layout as
+ * #ids.
+ *
+ * The hashes may collide, so the candidates have to be compared again.
+ */
+static GHashTable *duplicates = NULL;
+
+/**
+ * Icon surfaces of compacted history entries by their icon_id, so
+ * identical icons are only kept once, see queues_history_compact(). The
+ * surfaces are not referenced by the table and remove themselves on
+ * destruction.
+ */
+static GHashTable *history_icons = NULL;
+
+/** Whether the persistent history log got loaded, see queues_history_restore() */
+static bool history_restored = false;
+
+/** Records the history log may hold beyond twice the history entries */
+#define HISTORY_LOG_SLACK 32
+
+/**
+ * A point in time, at which a displayed notification changes
+ */
+struct queue_timer {
+        gint64 time; /**< when the timer fires */
+        gint id;     /**< the id of the displayed notification */
+};
+
+/**
+ * The timers of the displayed notifications as binary min-heaps of struct
+ * queue_timer, so the next change doesn't have to be searched for and
+ * queues_update() only has to look at the notifications which are due.
+ *
+ * Timers get added when a notification gets displayed or restarted and are
+ * never searched for. A timer, which doesn't match its notification
+ * anymore, gets dropped once it reaches the top of its heap.
+ */
+static struct {
+        GArray *timeouts; /**< by the start of a notification plus its timeout */
+        GArray *ages;     /**< by the timestamp of a notification */
+        struct dunst_status status; /**< the status of the last queues_update() */
+        bool check_all;   /**< check all displayed notifications on the next update */
+} timers;
+
+/**
+ * Changes whenever the waiting or displayed notifications change, see
+ * queues_generation()
+ */
+static guint generation = 0;
+static gint64 generation_age = -1; /**< The second of the ages last shown */
+
 int next_notification_id = 1;
 
 static bool queues_stack_duplicate(struct notification *n);
 static bool queues_stack_by_tag(struct notification *n);
 
+static void queues_index_free_entries(gpointer data)
+{
+        g_queue_free_full(data, g_free);
+}
+
 void queues_init(void)
 {
         history   = g_queue_new();
         displayed = g_queue_new();
         waiting   = g_queue_new();
+        ids        = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL, queues_index_free_entries);
+        stack_tags = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL, queues_index_free_entries);
+        duplicates = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           NULL, queues_index_free_entries);
+        history_icons = g_hash_table_new(g_str_hash, g_str_equal);
+        history_restored = false;
+        timers.timeouts = g_array_new(FALSE, FALSE, sizeof(struct queue_timer));
+        timers.ages     = g_array_new(FALSE, FALSE, sizeof(struct queue_timer));
+        timers.check_all = true;
+        generation++;
 }
 
 GList *queues_get_displayed(void)
@@ -60,14 +158,353 @@ unsigned int queues_length_displayed(void)
 
 unsigned int queues_length_history(void)
 {
+        queues_history_restore();
         return history->length;
 }
 
 GList *queues_get_history(void)
 {
+        queues_history_restore();
         return g_queue_peek_head_link(history);
 }
 
+GList *queues_get_history_last(void)
+{
+        queues_history_restore();
+        return g_queue_peek_tail_link(history);
+}
+
+static guint queues_str_hash(const char *str)
+{
+        return str ? g_str_hash(str) : 0;
+}
+
+static gpointer queues_stack_tag_key(const struct notification *n)
+{
+        guint hash = queues_str_hash(n->appname);
+        hash = hash * 31 + queues_str_hash(n->stack_tag);
+        return GUINT_TO_POINTER(hash);
+}
+
+/* The icon is left out, as it is compared by notification_is_duplicate()
+ * only in some cases. */
+static gpointer queues_duplicate_key(const struct notification *n)
+{
+        guint hash = queues_str_hash(n->appname);
+        hash = hash * 31 + queues_str_hash(n->summary);
+        hash = hash * 31 + queues_str_hash(n->body);
+        hash = hash * 31 + (guint)n->urgency;
+        return GUINT_TO_POINTER(hash);
+}
+
+static void queues_index_insert(GHashTable *index, gpointer key, GQueue *queue, GList *link)
+{
+        GQueue *entries = g_hash_table_lookup(index, key);
+        if (!entries) {
+                entries = g_queue_new();
+                g_hash_table_insert(index, key, entries);
+        }
+
+        struct queue_entry *entry = g_new(struct queue_entry, 1);
+        entry->queue = queue;
+        entry->link = link;
+        g_queue_push_tail(entries, entry);
+}
+
+static void queues_index_delete(GHashTable *index, gpointer key, GList *link)
+{
+        GQueue *entries = g_hash_table_lookup(index, key);
+        ASSERT_OR_RET(entries,);
+
+        for (GList *iter = g_queue_peek_head_link(entries); iter; iter = iter->next) {
+                struct queue_entry *entry = iter->data;
+                if (entry->link == link) {
+                        g_free(entry);
+                        g_queue_delete_link(entries, iter);
+                        break;
+                }
+        }
+
+        if (g_queue_is_empty(entries))
+                g_hash_table_remove(index, key);
+}
+
+/**
+ * Find the first link in queue filed under key in index
+ *
+ * @returns the link of the notification which got into queue first
+ * @retval NULL if there is none
+ */
+static GList *queues_index_lookup(GHashTable *index, gpointer key, const GQueue *queue)
+{
+        GQueue *entries = g_hash_table_lookup(index, key);
+        if (!entries)
+                return NULL;
+
+        for (GList *iter = g_queue_peek_head_link(entries); iter; iter = iter->next) {
+                struct queue_entry *entry = iter->data;
+                if (entry->queue == queue)
+                        return entry->link;
+        }
+
+        return NULL;
+}
+
+/**
+ * Find all links in queue filed under key in index
+ *
+ * @returns (transfer container) the links in the order of queue
+ */
+static GList *queues_index_lookup_all(GHashTable *index, gpointer key, GQueue *queue)
+{
+        GQueue *entries = g_hash_table_lookup(index, key);
+        GList *links = NULL;
+        if (!entries)
+                return NULL;
+
+        for (GList *iter = g_queue_peek_tail_link(entries); iter; iter = iter->prev) {
+                struct queue_entry *entry = iter->data;
+                if (entry->queue == queue)
+                        links = g_list_prepend(links, entry->link);
+        }
+
+        // Rarely more than one, so only then walk the queue to get its order
+        if (links && links->next) {
+                GList *sorted = NULL;
+                for (GList *iter = g_queue_peek_tail_link(queue); iter; iter = iter->prev) {
+                        if (g_list_find(links, iter))
+                                sorted = g_list_prepend(sorted, iter);
+                }
+                g_list_free(links);
+                links = sorted;
+        }
+
+        return links;
+}
+
+static void queues_timer_push(GArray *heap, gint64 time, gint id)
+{
+        struct queue_timer timer = { time, id };
+        g_array_set_size(heap, heap->len + 1);
+
+        struct queue_timer *entries = (struct queue_timer *) heap->data;
+        guint i = heap->len - 1;
+        while (i > 0 && entries[(i - 1) / 2].time > time) {
+                entries[i] = entries[(i - 1) / 2];
+                i = (i - 1) / 2;
+        }
+        entries[i] = timer;
+}
+
+static struct queue_timer queues_timer_pop(GArray *heap)
+{
+        struct queue_timer *entries = (struct queue_timer *) heap->data;
+        struct queue_timer top = entries[0];
+        struct queue_timer last = entries[heap->len - 1];
+        g_array_set_size(heap, heap->len - 1);
+
+        guint i = 0;
+        while (2 * i + 1 < heap->len) {
+                guint child = 2 * i + 1;
+                if (child + 1 < heap->len && entries[child + 1].time < entries[child].time)
+                        child++;
+                if (entries[child].time >= last.time)
+                        break;
+                entries[i] = entries[child];
+                i = child;
+        }
+        if (heap->len > 0)
+                entries[i] = last;
+
+        return top;
+}
+
+/**
+ * Look up the displayed notification of a timer
+ *
+ * @param timer The timer
+ * @param timeout Whether timer is from #timers.timeouts or #timers.ages
+ *
+ * @returns the notification
+ * @retval NULL if the timer doesn't match a displayed notification anymore
+ */
+static struct notification *queues_timer_lookup(const struct queue_timer *timer, bool timeout)
+{
+        GList *link = queues_index_lookup(ids, GINT_TO_POINTER(timer->id), displayed);
+        if (!link)
+                return NULL;
+
+        struct notification *n = link->data;
+        if (timeout && (n->timeout <= 0 || n->start + n->timeout != timer->time))
+                return NULL;
+        if (!timeout && n->timestamp != timer->time)
+                return NULL;
+
+        return n;
+}
+
+/**
+ * Drop the timers off the top of heap, which don't match their
+ * notifications anymore.
+ *
+ * @returns the notification of the first timer in heap
+ * @retval NULL if heap is empty
+ */
+static struct notification *queues_timer_peek(GArray *heap, bool timeout)
+{
+        while (heap->len > 0) {
+                struct notification *n = queues_timer_lookup(&g_array_index(heap, struct queue_timer, 0), timeout);
+                if (n)
+                        return n;
+                queues_timer_pop(heap);
+        }
+        return NULL;
+}
+
+/**
+ * Add the timeout of a displayed notification, after its start changed
+ */
+static void queues_timer_restart(const struct notification *n)
+{
+        if (n->timeout > 0)
+                queues_timer_push(timers.timeouts, n->start + n->timeout, n->id);
+}
+
+/**
+ * Add the timers of a notification entering displayed
+ */
+static void queues_timer_display(const struct notification *n)
+{
+        queues_timer_restart(n);
+        queues_timer_push(timers.ages, n->timestamp, n->id);
+}
+
+/**
+ * Replace all timers with the ones of the displayed notifications
+ */
+static void queues_timers_rebuild(void)
+{
+        g_array_set_size(timers.timeouts, 0);
+        g_array_set_size(timers.ages, 0);
+        for (GList *iter = g_queue_peek_head_link(displayed); iter; iter = iter->next)
+                queues_timer_display(iter->data);
+}
+
+/**
+ * File the link in the stacking indices, if queue is subject to stacking
+ */
+static void queues_index_add_stacking(GQueue *queue, GList *link)
+{
+        const struct notification *n = link->data;
+
+        if (queue == history)
+                return;
+
+        if (STR_FULL(n->stack_tag))
+                queues_index_insert(stack_tags, queues_stack_tag_key(n), queue, link);
+        queues_index_insert(duplicates, queues_duplicate_key(n), queue, link);
+}
+
+static void queues_index_remove_stacking(GQueue *queue, GList *link)
+{
+        const struct notification *n = link->data;
+
+        if (queue == history)
+                return;
+
+        if (STR_FULL(n->stack_tag))
+                queues_index_delete(stack_tags, queues_stack_tag_key(n), link);
+        queues_index_delete(duplicates, queues_duplicate_key(n), link);
+}
+
+static void queues_index_add(GQueue *queue, GList *link)
+{
+        const struct notification *n = link->data;
+
+        queues_index_insert(ids, GINT_TO_POINTER(n->id), queue, link);
+        queues_index_add_stacking(queue, link);
+
+        if (queue == displayed)
+                queues_timer_display(n);
+}
+
+static void queues_index_remove(GQueue *queue, GList *link)
+{
+        const struct notification *n = link->data;
+
+        queues_index_delete(ids, GINT_TO_POINTER(n->id), link);
+        queues_index_remove_stacking(queue, link);
+}
+
+/**
+ * Find the link of the notification with the given id in queue
+ *
+ * @returns the link of the notification which got into queue first
+ * @retval NULL if queue has no notification with this id
+ */
+static GList *queues_index_find(gint id, const GQueue *queue)
+{
+        return queues_index_lookup(ids, GINT_TO_POINTER(id), queue);
+}
+
+/**
+ * Insert n into queue at its sorted position, like g_queue_insert_sorted().
+ */
+static void queues_link_insert_sorted(GQueue *queue, struct notification *n)
+{
+        GList *sibling = g_queue_peek_head_link(queue);
+        while (sibling && notification_cmp(sibling->data, n) < 0)
+                sibling = sibling->next;
+
+        g_queue_insert_before(queue, sibling, n);
+        queues_index_add(queue, sibling ? sibling->prev : g_queue_peek_tail_link(queue));
+        if (queue != history)
+                generation++;
+}
+
+static void queues_link_push_tail(GQueue *queue, struct notification *n)
+{
+        g_queue_push_tail(queue, n);
+        queues_index_add(queue, g_queue_peek_tail_link(queue));
+        if (queue != history)
+                generation++;
+}
+
+/**
+ * Remove link from queue
+ *
+ * @returns the notification of the link
+ */
+static struct notification *queues_link_delete(GQueue *queue, GList *link)
+{
+        struct notification *n = link->data;
+
+        queues_index_remove(queue, link);
+        g_queue_delete_link(queue, link);
+        if (queue != history)
+                generation++;
+
+        return n;
+}
+
+/**
+ * Put new in place of the notification at link
+ *
+ * @returns the replaced notification
+ */
+static struct notification *queues_link_replace(GQueue *queue, GList *link, struct notification *new)
+{
+        struct notification *old = link->data;
+
+        queues_index_remove(queue, link);
+        link->data = new;
+        queues_index_add(queue, link);
+        if (queue != history)
+                generation++;
+
+        return old;
+}
+
 /**
  * Swap two given queue elements. The element's data has to be a notification.
  *
@@ -84,16 +521,13 @@ static void queues_swap_notifications(GQueue *queueA,
                                       GQueue *queueB,
                                       GList  *elemB)
 {
-        struct notification *toB = elemA->data;
-        struct notification *toA = elemB->data;
-
-        g_queue_delete_link(queueA, elemA);
-        g_queue_delete_link(queueB, elemB);
+        struct notification *toB = queues_link_delete(queueA, elemA);
+        struct notification *toA = queues_link_delete(queueB, elemB);
 
         if (toA)
-                g_queue_insert_sorted(queueA, toA, notification_cmp_data, NULL);
+                queues_link_insert_sorted(queueA, toA);
         if (toB)
-                g_queue_insert_sorted(queueB, toB, notification_cmp_data, NULL);
+                queues_link_insert_sorted(queueB, toB);
 }
 
 /**
@@ -140,18 +574,18 @@ static bool queues_notification_is_finished(struct notification *n, struct dunst
 
         /* don't timeout when user is idle */
         if (is_idle && !n->transient) {
-                n->start = time_monotonic_now();
+                n->start = time;
                 return false;
         }
 
         /* don't timeout when mouse is over the notification window */
         if (status.mouse_over && !n->transient) {
-                n->start = time_monotonic_now();
+                n->start = time;
                 return false;
         }
 
-        /* remove old message */
-        if (time - n->start > n->timeout) {
+        /* remove old message, the same moment its timer is due */
+        if (time - n->start >= n->timeout) {
                 return true;
         }
 
@@ -173,7 +607,7 @@ int queues_notification_insert(struct notification *n, struct dunst_status statu
         if (n->id != 0) {
                 if (!queues_notification_replace_id(n)) {
                         // Requested id was not valid, but play nice and assign it anyway
-                        g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+                        queues_link_insert_sorted(waiting, n);
                 }
                 inserted = true;
         } else {
@@ -191,13 +625,13 @@ int queues_notification_insert(struct notification *n, struct dunst_status statu
         }
 
         if (!inserted)
-                g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+                queues_link_insert_sorted(waiting, n);
 
         /* The icon is loaded lazily.
          * This is skipped if the icon was transferred.
          */
         if (!n->icon) {
-                notification_icon_replace_path(n, n->iconname);
+                notification_icon_load_path(n, n->iconname);
         }
 
         if (print_notifications)
@@ -221,17 +655,24 @@ int queues_notification_insert(struct notification *n, struct dunst_status statu
 static bool queues_stack_duplicate(struct notification *new)
 {
         gint64 modtime = -1;
+        gpointer key = queues_duplicate_key(new);
 
         GQueue *allqueues[] = { displayed, waiting };
         for (size_t i = 0; i < G_N_ELEMENTS(allqueues); i++) {
-                for (GList *iter = g_queue_peek_head_link(allqueues[i]); iter; iter = iter->next) {
+                GList *candidates = queues_index_lookup_all(duplicates, key, allqueues[i]);
+                for (GList *citer = candidates; citer; citer = citer->next) {
+                        GList *iter = citer->data;
                         struct notification *old = iter->data;
                         if (notification_is_duplicate(old, new)) {
 
                                 // Additional check to see if the icon was modified
                                 // But only if the icon is from a file
                                 //
-                                if (old->icon && !new->icon_id && is_like_path(old->iconname)) {
+                                // While the icon of old is still being loaded, it only
+                                // shows a placeholder without an icon_id. The icon names
+                                // got compared by notification_is_duplicate() then.
+                                if (old->icon && !old->icon_load && !new->icon_id
+                                    && is_like_path(old->iconname)) {
                                         if (modtime < 0)
                                                 modtime = modification_time(old->iconname);
 
@@ -254,21 +695,23 @@ static bool queues_stack_duplicate(struct notification *new)
                                 } else {
                                         old->progress = new->progress;
                                 }
-                                iter->data = new;
+                                if (allqueues[i] == displayed)
+                                        new->start = time_monotonic_now();
+                                queues_link_replace(allqueues[i], iter, new);
 
                                 new->dup_count = old->dup_count;
                                 signal_notification_closed(old, 1);
 
                                 /* Run script if the duplicate notification is already displayed */
-                                if (allqueues[i] == displayed) {
-                                        new->start = time_monotonic_now();
+                                if (allqueues[i] == displayed)
                                         notification_run_script(new);
-                                }
 
                                 notification_unref(old);
+                                g_list_free(candidates);
                                 return true;
                         }
                 }
+                g_list_free(candidates);
         }
 
         return false;
@@ -282,13 +725,19 @@ static bool queues_stack_duplicate(struct notification *new)
  */
 static bool queues_stack_by_tag(struct notification *new)
 {
+        gpointer key = queues_stack_tag_key(new);
+
         GQueue *allqueues[] = { displayed, waiting };
         for (size_t i = 0; i < sizeof(allqueues)/sizeof(GQueue*); i++) {
-                for (GList *iter = g_queue_peek_head_link(allqueues[i]); iter; iter = iter->next) {
+                GList *candidates = queues_index_lookup_all(stack_tags, key, allqueues[i]);
+                for (GList *citer = candidates; citer; citer = citer->next) {
+                        GList *iter = citer->data;
                         struct notification *old = iter->data;
                         if (STR_FULL(old->stack_tag) && STR_EQ(old->stack_tag, new->stack_tag)
                                         && STR_EQ(old->appname, new->appname)) {
-                                iter->data = new;
+                                if (allqueues[i] == displayed)
+                                        new->start = time_monotonic_now();
+                                queues_link_replace(allqueues[i], iter, new);
                                 new->dup_count = old->dup_count;
 
                                 bool replace = false;
@@ -312,18 +761,18 @@ static bool queues_stack_by_tag(struct notification *new)
                                 signal_notification_closed(old, 1);
 
                                 /* Run script if the stacked notification is already displayed */
-                                if (allqueues[i] == displayed) {
-                                        new->start = time_monotonic_now();
+                                if (allqueues[i] == displayed)
                                         notification_run_script(new);
-                                }
 
                                 if (replace)
                                         notification_transfer_icon(old, new);
 
                                 notification_unref(old);
+                                g_list_free(candidates);
                                 return true;
                         }
                 }
+                g_list_free(candidates);
         }
         return false;
 }
@@ -332,23 +781,21 @@ bool queues_notification_replace_id(struct notification *new)
 {
         GQueue *allqueues[] = { displayed, waiting };
         for (size_t i = 0; i < sizeof(allqueues)/sizeof(GQueue*); i++) {
-                for (GList *iter = g_queue_peek_head_link(allqueues[i]);
-                            iter;
-                            iter = iter->next) {
-                        struct notification *old = iter->data;
-                        if (old->id == new->id) {
-                                iter->data = new;
-                                new->dup_count = old->dup_count;
+                GList *link = queues_index_find(new->id, allqueues[i]);
+                if (!link)
+                        continue;
 
-                                if (allqueues[i] == displayed) {
-                                        new->start = time_monotonic_now();
-                                        notification_run_script(new);
-                                }
+                if (allqueues[i] == displayed)
+                        new->start = time_monotonic_now();
 
-                                notification_unref(old);
-                                return true;
-                        }
-                }
+                struct notification *old = queues_link_replace(allqueues[i], link, new);
+                new->dup_count = old->dup_count;
+
+                if (allqueues[i] == displayed)
+                        notification_run_script(new);
+
+                notification_unref(old);
+                return true;
         }
         return false;
 }
@@ -358,16 +805,10 @@ void queues_notification_close_id(gint id, enum reason reason)
         struct notification *target = NULL;
 
         GQueue *allqueues[] = { displayed, waiting };
-        for (size_t i = 0; i < sizeof(allqueues)/sizeof(GQueue*); i++) {
-                for (GList *iter = g_queue_peek_head_link(allqueues[i]); iter;
-                     iter = iter->next) {
-                        struct notification *n = iter->data;
-                        if (n->id == id) {
-                                g_queue_remove(allqueues[i], n);
-                                target = n;
-                                break;
-                        }
-                }
+        for (size_t i = 0; i < sizeof(allqueues)/sizeof(GQueue*) && !target; i++) {
+                GList *link = queues_index_find(id, allqueues[i]);
+                if (link)
+                        target = queues_link_delete(allqueues[i], link);
         }
 
         if (target) {
@@ -391,68 +832,178 @@ void queues_notification_remove(struct notification *n, enum reason reason)
         queues_history_remove_by_id(n->id);
 }
 
-static void queues_destroy_notification(struct notification *n, gpointer user_data)
-{
-        (void)user_data;
-        notification_unref(n);
-}
-
 guint queues_history_clear(void)
 {
+        queues_history_restore();
+
         guint n = g_queue_get_length(history);
-        g_queue_foreach(history, (GFunc)queues_destroy_notification, NULL);
-        g_queue_clear(history);
+        while (!g_queue_is_empty(history)) {
+                struct notification *to_free = queues_link_delete(history, g_queue_peek_head_link(history));
+                notification_unref(to_free);
+        }
+        history_log_clear();
         return n;
 }
 
-void queues_history_pop(void)
+static const cairo_user_data_key_t history_icon_key;
+
+/**
+ * Destroy notifier of a surface in #history_icons
+ *
+ * @param data The icon_id the surface is stored under
+ */
+static void queues_history_icon_destroyed(void *data)
 {
-        if (g_queue_is_empty(history))
+        gpointer key;
+        // The table may already hold another surface under the same id
+        if (history_icons
+            && g_hash_table_lookup_extended(history_icons, data, &key, NULL)
+            && key == data)
+                g_hash_table_remove(history_icons, data);
+        g_free(data);
+}
+
+/**
+ * Strip a notification entering history down to what history needs.
+ *
+ * The icon surface is shared with all other history entries showing the
+ * same image, which are usually many for the same application. The
+ * rendered text and the actions are not needed anymore once the
+ * notification is closed; the text gets rendered again when the
+ * notification is popped from history.
+ *
+ * @param n The notification being pushed to history
+ */
+static void queues_history_compact(struct notification *n)
+{
+        g_clear_pointer(&n->text_to_render, g_free);
+        g_clear_pointer(&n->age_to_render, g_free);
+        notification_invalidate_actions(n);
+
+        if (!n->icon || !n->icon_id)
+                return;
+
+        cairo_surface_t *shared = g_hash_table_lookup(history_icons, n->icon_id);
+        if (shared == n->icon)
                 return;
 
-        struct notification *n = g_queue_pop_tail(history);
+        if (shared) {
+                cairo_surface_destroy(n->icon);
+                n->icon = cairo_surface_reference(shared);
+                return;
+        }
+
+        char *key = g_strdup(n->icon_id);
+        if (cairo_surface_set_user_data(n->icon, &history_icon_key, key,
+                                        queues_history_icon_destroyed) == CAIRO_STATUS_SUCCESS)
+                g_hash_table_insert(history_icons, key, n->icon);
+        else
+                g_free(key);
+}
+
+void queues_history_restore(void)
+{
+        if (history_restored || !history_log_is_open())
+                return;
+        history_restored = true;
+
+        GList *restored = history_log_load(MAX(settings.history_length, 0));
+        for (GList *iter = restored; iter; iter = iter->next) {
+                struct notification *n = iter->data;
+
+                // The ids of the log are from a previous run
+                n->id = ++next_notification_id;
+                n->history_time = time_monotonic_now();
+
+                if (settings.history_compact)
+                        queues_history_compact(n);
+
+                queues_link_push_tail(history, n);
+        }
+        g_list_free(restored);
+
+        // Store the new ids and drop what got removed or evicted
+        history_log_rewrite(g_queue_peek_head_link(history));
+}
+
+/**
+ * Rewrite the history log, once the records of removed, evicted or
+ * replaced notifications outnumber the entries still in the history.
+ * Done independently of history_length, as an unlimited history
+ * would let the log grow without bound otherwise.
+ */
+static void queues_history_log_compact(void)
+{
+        if (history_log_records() > 2 * history->length + HISTORY_LOG_SLACK)
+                history_log_rewrite(g_queue_peek_head_link(history));
+}
+
+/**
+ * Move n from the history back to the waiting queue
+ */
+static void queues_history_redisplay(struct notification *n)
+{
+        history_log_remove(n->id);
+        queues_history_log_compact();
+
         n->redisplayed = true;
         n->timeout = settings.sticky_history ? 0 : n->timeout;
-        g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+
+        // Entries restored from the log come without an icon
+        if (!n->icon && n->iconname)
+                notification_icon_load_path(n, n->iconname);
+
+        queues_link_insert_sorted(waiting, n);
 }
 
-void queues_history_pop_by_id(gint id)
+void queues_history_pop(void)
 {
-        struct notification *n = NULL;
+        queues_history_restore();
 
         if (g_queue_is_empty(history))
                 return;
 
+        struct notification *n = queues_link_delete(history, g_queue_peek_tail_link(history));
+        queues_history_redisplay(n);
+}
+
+void queues_history_pop_by_id(gint id)
+{
+        queues_history_restore();
+
         // search through the history buffer
-        for (GList *iter = g_queue_peek_head_link(history); iter;
-                iter = iter->next) {
-                struct notification *cur = iter->data;
-                if (cur->id == id) {
-                        n = cur;
-                        break;
-                }
-        }
+        GList *link = queues_index_find(id, history);
 
         // must be a valid notification
-        if (n == NULL)
+        if (link == NULL)
                 return;
 
-        g_queue_remove(history, n);
-        n->redisplayed = true;
-        n->timeout = settings.sticky_history ? 0 : n->timeout;
-        g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+        struct notification *n = queues_link_delete(history, link);
+        queues_history_redisplay(n);
 }
 
 void queues_history_push(struct notification *n)
 {
+        queues_history_restore();
+
         if (!n->history_ignore) {
                 guint maxlen = settings.history_length;
                 if (settings.history_length > 0 && history->length >= maxlen) {
-                        struct notification *to_free = g_queue_pop_head(history);
+                        struct notification *to_free = queues_link_delete(history, g_queue_peek_head_link(history));
                         notification_unref(to_free);
                 }
 
-                g_queue_push_tail(history, n);
+                // The text gets laid out again when it is popped
+                g_clear_pointer(&n->layout_cache, draw_layout_cache_free);
+
+                if (settings.history_compact)
+                        queues_history_compact(n);
+
+                n->history_time = time_monotonic_now();
+                queues_link_push_tail(history, n);
+
+                history_log_append(n);
+                queues_history_log_compact();
         } else {
                 notification_unref(n);
         }
@@ -470,81 +1021,121 @@ void queues_history_push_all(void)
 }
 
 bool queues_history_remove_by_id(gint id) {
-        struct notification *n = NULL;
+        queues_history_restore();
 
-        if (g_queue_is_empty(history))
-                return false;
-
-        for (GList *iter = g_queue_peek_head_link(history); iter;
-                iter = iter->next) {
-                struct notification *cur = iter->data;
-                if (cur->id == id) {
-                        n = cur;
-                        break;
-                }
-        }
+        GList *link = queues_index_find(id, history);
 
-        if (n == NULL)
+        if (link == NULL)
                 return false;
 
-        g_queue_remove(history, n);
-        notification_unref(n);
+        notification_unref(queues_link_delete(history, link));
+        history_log_remove(id);
+        queues_history_log_compact();
         return true;
 }
 
-void queues_update(struct dunst_status status, gint64 time)
+/**
+ * Close the displayed notification at link or move it back to waiting, if
+ * it is finished or not eligible to get shown anymore.
+ */
+static void queues_update_displayed(GList *link, struct dunst_status status, gint64 time)
 {
-        GList *iter, *nextiter;
+        struct notification *n = link->data;
 
-        /* Move back all notifications, which aren't eligible to get shown anymore
-         * Will move the notifications back to waiting, if dunst isn't running or fullscreen
-         * and notifications is not eligible to get shown anymore */
-        iter = g_queue_peek_head_link(displayed);
-        while (iter) {
-                struct notification *n = iter->data;
-                nextiter = iter->next;
+        if (notification_is_locked(n))
+                return;
 
-                if (notification_is_locked(n)) {
-                        iter = nextiter;
-                        continue;
-                }
+        if (n->marked_for_closure) {
+                queues_notification_close(n, n->marked_for_closure);
+                n->marked_for_closure = 0;
+                return;
+        }
 
-                if (n->marked_for_closure) {
-                        queues_notification_close(n, n->marked_for_closure);
-                        n->marked_for_closure = 0;
-                        iter = nextiter;
-                        continue;
-                }
+        if (n->marked_for_removal) {
+                queues_notification_remove(n, n->marked_for_removal);
+                n->marked_for_removal = 0;
+                return;
+        }
 
-                if (n->marked_for_removal) {
-                        queues_notification_remove(n, n->marked_for_removal);
-                        n->marked_for_removal = 0;
-                        iter = nextiter;
-                        continue;
-                }
+        if (queues_notification_is_finished(n, status, time)) {
+                queues_notification_close(n, REASON_TIME);
+                return;
+        }
 
+        if (status.fullscreen && n->fullscreen == FS_SUPPRESS) {
+                queues_notification_close(n, REASON_UNDEF);
+                return;
+        }
 
-                if (queues_notification_is_finished(n, status, time)) {
-                        queues_notification_close(n, REASON_TIME);
-                        iter = nextiter;
-                        continue;
-                }
+        if (!queues_notification_is_ready(n, status, true)) {
+                queues_link_delete(displayed, link);
+                queues_link_insert_sorted(waiting, n);
+        }
+}
 
-                if (status.fullscreen && n->fullscreen == FS_SUPPRESS) {
-                        queues_notification_close(n, REASON_UNDEF);
-                        iter = nextiter;
+/**
+ * Check the displayed notifications whose timeout is due. The others can't
+ * have changed, as long as the status stays the same.
+ */
+static void queues_update_due(struct dunst_status status, gint64 time)
+{
+        GArray *due = g_array_new(FALSE, FALSE, sizeof(gint));
+        GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+        // Collect them first, as the timers of the ones staying get added again
+        while (queues_timer_peek(timers.timeouts, true)
+               && time >= g_array_index(timers.timeouts, struct queue_timer, 0).time) {
+                struct queue_timer timer = queues_timer_pop(timers.timeouts);
+                if (g_hash_table_add(seen, GINT_TO_POINTER(timer.id)))
+                        g_array_append_val(due, timer.id);
+        }
+
+        for (guint i = 0; i < due->len; i++) {
+                gint id = g_array_index(due, gint, i);
+                GList *link = queues_index_find(id, displayed);
+                if (!link)
                         continue;
-                }
 
-                if (!queues_notification_is_ready(n, status, true)) {
-                        g_queue_delete_link(displayed, iter);
-                        g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+                queues_update_displayed(link, status, time);
+
+                // Not timed out yet or locked, so it is still due
+                link = queues_index_find(id, displayed);
+                if (link)
+                        queues_timer_restart(link->data);
+        }
+
+        g_hash_table_unref(seen);
+        g_array_free(due, TRUE);
+}
+
+void queues_update(struct dunst_status status, gint64 time)
+{
+        GList *iter, *nextiter;
+
+        /* While the user is idle or over the window, the timeouts of all
+         * notifications get restarted on every update */
+        bool held = (timers.status.idle && !timers.status.fullscreen) || timers.status.mouse_over;
+
+        if (timers.check_all || held
+            || status.fullscreen != timers.status.fullscreen
+            || status.pause_level != timers.status.pause_level
+            || status.idle != timers.status.idle
+            || status.mouse_over != timers.status.mouse_over) {
+                /* Move back all notifications, which aren't eligible to get shown anymore
+                 * Will move the notifications back to waiting, if dunst isn't running or fullscreen
+                 * and notifications is not eligible to get shown anymore */
+                iter = g_queue_peek_head_link(displayed);
+                while (iter) {
+                        nextiter = iter->next;
+                        queues_update_displayed(iter, status, time);
                         iter = nextiter;
-                        continue;
                 }
-
-                iter = nextiter;
+                queues_timers_rebuild();
+        } else {
+                queues_update_due(status, time);
         }
+        timers.status = status;
+        timers.check_all = false;
 
         int cur_displayed_limit;
         if (settings.notification_limit == 0)
@@ -584,8 +1175,8 @@ void queues_update(struct dunst_status status, gint64 time)
                 if (n->skip_display && !n->redisplayed) {
                         queues_notification_close(n, REASON_USER);
                 } else {
-                        g_queue_delete_link(waiting, iter);
-                        g_queue_insert_sorted(displayed, n, notification_cmp_data, NULL);
+                        queues_link_delete(waiting, iter);
+                        queues_link_insert_sorted(displayed, n);
                 }
 
                 iter = nextiter;
@@ -593,8 +1184,8 @@ void queues_update(struct dunst_status status, gint64 time)
 
         /* if necessary, push the overhanging notifications from displayed to waiting again */
         while (displayed->length > cur_displayed_limit) {
-                struct notification *n = g_queue_pop_tail(displayed);
-                g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL); //TODO: actually it should be on the head if unsorted
+                struct notification *n = queues_link_delete(displayed, g_queue_peek_tail_link(displayed));
+                queues_link_insert_sorted(waiting, n); //TODO: actually it should be on the head if unsorted
         }
 
         /* If displayed is actually full, let the more important notifications
@@ -623,49 +1214,89 @@ void queues_update(struct dunst_status status, gint64 time)
                                 queues_swap_notifications(displayed, i_displayed, waiting, i_waiting);
                 }
         }
+
+        // Drop the timers piling up for restarted and closed notifications
+        if (timers.timeouts->len + timers.ages->len > 4 * displayed->length + 32)
+                queues_timers_rebuild();
+
         signal_length_propertieschanged();
 }
 
+void queues_check_all(void)
+{
+        timers.check_all = true;
+}
+
 gint64 queues_get_next_datachange(gint64 time)
 {
         gint64 wakeup_time = G_MAXINT64;
         gint64 next_second = time + S2US(1) - (time % S2US(1));
 
-        for (GList *iter = g_queue_peek_head_link(displayed); iter;
-                        iter = iter->next) {
-                struct notification *n = iter->data;
-                gint64 timeout_ts = n->start + n->timeout;
+        /* Locked notifications don't time out, so set their timers aside
+         * until the first one of an unlocked notification is found */
+        GArray *locked = NULL;
+        struct notification *n;
+        while ((n = queues_timer_peek(timers.timeouts, true)) && notification_is_locked(n)) {
+                if (!locked)
+                        locked = g_array_new(FALSE, FALSE, sizeof(struct queue_timer));
+                struct queue_timer timer = queues_timer_pop(timers.timeouts);
+                g_array_append_val(locked, timer);
+        }
 
-                if (n->timeout > 0 && n->locked == 0) {
-                        if (timeout_ts > time)
-                                wakeup_time = MIN(wakeup_time, timeout_ts);
-                        else
-                                // while we're processing or while locked, the notification already timed out
-                                return time;
+        if (n)
+                wakeup_time = g_array_index(timers.timeouts, struct queue_timer, 0).time;
+
+        if (locked) {
+                for (guint i = 0; i < locked->len; i++) {
+                        const struct queue_timer *timer = &g_array_index(locked, struct queue_timer, i);
+                        queues_timer_push(timers.timeouts, timer->time, timer->id);
                 }
+                g_array_free(locked, TRUE);
+        }
 
-                if (settings.show_age_threshold >= 0) {
-                        gint64 age = time - n->timestamp;
-
-                        if (age > settings.show_age_threshold - S2US(1)) {
-                                /* Notification age should be updated -- sleep
-                                 * until the next turn of second.
-                                 * This ensures that all notifications' ages
-                                 * will change at once, and that at most one
-                                 * update will occur each second for this
-                                 * purpose. */
-                                wakeup_time = MIN(wakeup_time, next_second);
-                        }
-                        else
-                                wakeup_time = MIN(wakeup_time, n->timestamp + settings.show_age_threshold);
+        // while we're processing or while locked, the notification already timed out
+        if (wakeup_time <= time)
+                return time;
+
+        /* The oldest notification is the first to show its age and as long
+         * as it does, the age has to be updated */
+        if (settings.show_age_threshold >= 0 && (n = queues_timer_peek(timers.ages, false))) {
+                gint64 age = time - n->timestamp;
+
+                if (age > settings.show_age_threshold - S2US(1)) {
+                        /* Notification age should be updated -- sleep
+                         * until the next turn of second.
+                         * This ensures that all notifications' ages
+                         * will change at once, and that at most one
+                         * update will occur each second for this
+                         * purpose. */
+                        wakeup_time = MIN(wakeup_time, next_second);
                 }
+                else
+                        wakeup_time = MIN(wakeup_time, n->timestamp + settings.show_age_threshold);
         }
 
         return wakeup_time != G_MAXINT64 ? wakeup_time : -1;
 }
 
+guint queues_generation(gint64 time)
+{
+        /* The shown ages are counted from the timestamps floored to the
+         * second, so all of them change at once at the turn of a second,
+         * see notification_update_text_to_render() */
+        gint64 age = -1;
+        struct notification *n = queues_timer_peek(timers.ages, false);
+        if (n && settings.show_age_threshold >= 0
+            && time - (n->timestamp - n->timestamp % S2US(1)) >= settings.show_age_threshold)
+                age = US2S(time);
+
+        if (age != generation_age) {
+                generation_age = age;
+                generation++;
+        }
 
-
+        return generation;
+}
 
 struct notification* queues_get_by_id(gint id)
 {
@@ -673,12 +1304,9 @@ struct notification* queues_get_by_id(gint id)
 
         GQueue *recqueues[] = { displayed, waiting, history };
         for (size_t i = 0; i < sizeof(recqueues)/sizeof(GQueue*); i++) {
-                for (GList *iter = g_queue_peek_head_link(recqueues[i]); iter;
-                     iter = iter->next) {
-                        struct notification *cur = iter->data;
-                        if (cur->id == id)
-                                return cur;
-                }
+                GList *link = queues_index_find(id, recqueues[i]);
+                if (link)
+                        return link->data;
         }
 
         return NULL;
@@ -691,12 +1319,21 @@ void queues_reapply_all_rules(void)
                 for (GList *iter = g_queue_peek_head_link(recqueues[i]); iter;
                      iter = iter->next) {
                         struct notification *cur = iter->data;
+
+                        // The rules may change the fields the notification is
+                        // indexed by for stacking
+                        queues_index_remove_stacking(recqueues[i], iter);
                         if (cur->original) {
                                 rule_apply(cur->original, cur, false);
                         }
                         rule_apply_all(cur);
+                        queues_index_add_stacking(recqueues[i], iter);
                 }
         }
+
+        // The rules may change the timeouts and how to treat the notifications
+        timers.check_all = true;
+        generation++;
 }
 
 /**
@@ -718,4 +1355,13 @@ void queues_teardown(void)
         displayed = NULL;
         g_queue_free_full(waiting, teardown_notification);
         waiting = NULL;
+        g_clear_pointer(&ids, g_hash_table_unref);
+        g_clear_pointer(&stack_tags, g_hash_table_unref);
+        g_clear_pointer(&duplicates, g_hash_table_unref);
+        g_clear_pointer(&history_icons, g_hash_table_unref);
+        if (timers.timeouts) {
+                g_array_free(timers.timeouts, TRUE);
+                g_array_free(timers.ages, TRUE);
+        }
+        memset(&timers, 0, sizeof(timers));
 }
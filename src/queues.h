@@ -45,6 +45,14 @@ GList *queues_get_displayed(void);
  */
 GList *queues_get_history(void);
 
+/**
+ * Receive the most recent element of the history list, to walk the
+ * history backwards via its prev pointers
+ *
+ * @return read only list of notifications
+ */
+GList *queues_get_history_last(void);
+
 /**
  * Get the highest notification in line
  *
@@ -68,6 +76,8 @@ unsigned int queues_length_displayed(void);
 /**
  * Returns the current amount of notifications,
  * which are already in history
+ *
+ * Does not include the persistent history before queues_history_restore().
  */
 unsigned int queues_length_history(void);
 
@@ -170,6 +180,15 @@ void queues_history_pop_by_id(gint id);
  */
 void queues_history_push(struct notification *n);
 
+/**
+ * Move the notifications of the persistent history log into history, if
+ * it is open and wasn't restored yet.
+ *
+ * Every function using the history calls this first. It is not done at
+ * startup, so the startup time doesn't depend on the size of the log.
+ */
+void queues_history_restore(void);
+
 /**
  * Push all waiting and displayed notifications to history
  */
@@ -193,6 +212,15 @@ bool queues_history_remove_by_id(gint id);
  */
 void queues_update(struct dunst_status status, gint64 time);
 
+/**
+ * Have the next queues_update() check all displayed notifications.
+ *
+ * Without a change of the status, queues_update() only checks the
+ * notifications whose timeout is due. Call this after changing a displayed
+ * notification outside of the queues, e.g. marking it for closure.
+ */
+void queues_check_all(void);
+
 /**
  * Calculate the distance to the next event, when an element in the
  * queues changes
@@ -207,6 +235,15 @@ void queues_update(struct dunst_status status, gint64 time);
  */
 gint64 queues_get_next_datachange(gint64 time);
 
+/**
+ * Get the generation of the waiting and displayed notifications, which
+ * changes whenever they change in a way that may be visible. This includes
+ * the ages shown at time.
+ *
+ * @param time the current time
+ */
+guint queues_generation(gint64 time);
+
 /**
  * Get the notification which has the given id in the displayed and waiting queue or
  * NULL if not found
@@ -20,6 +20,9 @@
 
 GSList *rules = NULL;
 
+static void rule_matchers_free(struct rule *r);
+static void rule_index_mark_stale(void);
+
 // NOTE: Internal, only for rule_apply(...)
 
 #define RULE_APPLY2(nprop, rprop, defval) \
@@ -197,19 +200,6 @@ void rule_print(const struct rule *r)
         printf("}\n");
 }
 
-/*
- * Check all rules if they match n and apply.
- */
-void rule_apply_all(struct notification *n)
-{
-        for (GSList *iter = rules; iter; iter = iter->next) {
-                struct rule *r = iter->data;
-                if (rule_matches_notification(r, n)) {
-                        rule_apply(r, n, true);
-                }
-        }
-}
-
 bool rule_apply_special_filters(struct rule *r, const char *name)
 {
         if (is_deprecated_section(name)) // shouldn't happen, but just in case
@@ -240,6 +230,7 @@ struct rule *rule_new(const char *name)
         struct rule *r = g_malloc0(sizeof(struct rule));
         *r = empty_rule;
         rules = g_slist_insert(rules, r, -1);
+        rule_index_mark_stale();
         r->name = g_strdup(name);
         if (is_special_section(name)) {
                 bool success = rule_apply_special_filters(r, name);
@@ -274,63 +265,211 @@ void rule_free(struct rule *r)
         g_free(r->script);
         g_free(r->set_stack_tag);
 
+        rule_matchers_free(r);
+        // The index must not point at freed rules, even if r was still in #rules
+        rule_index_mark_stale();
+
         g_free(r);
 }
 
 
-static inline bool rule_field_matches_string(const char *value, const char *pattern)
+/**
+ * The pattern syntax the filters of a rule are compiled for
+ */
+enum rule_match_mode {
+        RULE_MATCH_FNMATCH,
+        RULE_MATCH_REGEX,
+        RULE_MATCH_PCRE,
+};
+
+enum rule_filter {
+        RULE_FILTER_APPNAME,
+        RULE_FILTER_DESKTOP_ENTRY,
+        RULE_FILTER_SUMMARY,
+        RULE_FILTER_BODY,
+        RULE_FILTER_ICON,
+        RULE_FILTER_CATEGORY,
+        RULE_FILTER_STACK_TAG,
+        RULE_FILTER_COUNT,
+};
+
+static const size_t rule_filter_offsets[RULE_FILTER_COUNT] = {
+        [RULE_FILTER_APPNAME]       = offsetof(struct rule, appname),
+        [RULE_FILTER_DESKTOP_ENTRY] = offsetof(struct rule, desktop_entry),
+        [RULE_FILTER_SUMMARY]       = offsetof(struct rule, summary),
+        [RULE_FILTER_BODY]          = offsetof(struct rule, body),
+        [RULE_FILTER_ICON]          = offsetof(struct rule, icon),
+        [RULE_FILTER_CATEGORY]      = offsetof(struct rule, category),
+        [RULE_FILTER_STACK_TAG]     = offsetof(struct rule, stack_tag),
+};
+
+struct rule_pattern {
+        char *source;       //!< A copy of the filter string this pattern was compiled from
+        bool valid;         //!< False if the pattern failed to compile
+        union {
+                regex_t regex;
+                GRegex *pcre;
+        };
+};
+
+struct rule_matchers {
+        enum rule_match_mode mode;
+        struct rule_pattern patterns[RULE_FILTER_COUNT];
+};
+
+#define RULE_FILTER(r, f) (*(char **)((char *)(r) + rule_filter_offsets[f]))
+
+static enum rule_match_mode rule_match_mode_get(void)
 {
-        // Always match empty pattern
-        if (STR_EMPTY(pattern))
-                return true;
+        if (settings.enable_pcre)
+                return RULE_MATCH_PCRE;
+        if (settings.enable_regex)
+                return RULE_MATCH_REGEX;
+        return RULE_MATCH_FNMATCH;
+}
+
+static bool rule_pattern_compile(struct rule_pattern *p, const char *pattern, enum rule_match_mode mode)
+{
+        p->source = g_strdup(pattern);
+        p->valid = false;
 
-        // Never match null value
-        if (!value)
+        // Empty patterns always match, there is nothing to compile
+        if (STR_EMPTY(pattern))
                 return false;
 
         // Use GLib wrapper for PCRE
-        if (settings.enable_pcre) {
+        if (mode == RULE_MATCH_PCRE) {
                 GError *error = NULL;
 
-                // TODO: When caching regex use G_REGEX_OPTIMIZE
-                GRegex *regex = g_regex_new(pattern, 0, 0, &error);
+                p->pcre = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, &error);
                 if (error) {
                         LOG_W("Invalid PCRE Regex '%s': %s", pattern, error->message);
                         g_error_free(error);
                         return false;
                 }
-
-                bool matched = g_regex_match(regex, value, 0, NULL);
-                g_regex_unref(regex);
-                return matched;
         }
 
-        if (settings.enable_regex) {
-                regex_t regex;
-
-                // TODO: Compile each regex only once
-                int err = regcomp(&regex, pattern, REG_NEWLINE | REG_EXTENDED | REG_NOSUB);
+        if (mode == RULE_MATCH_REGEX) {
+                int err = regcomp(&p->regex, pattern, REG_NEWLINE | REG_EXTENDED | REG_NOSUB);
                 if (err) {
-                        size_t err_size = regerror(err, &regex, NULL, 0);
+                        size_t err_size = regerror(err, &p->regex, NULL, 0);
                         char *err_buf = g_malloc(err_size);
-                        regerror(err, &regex, err_buf, err_size);
+                        regerror(err, &p->regex, err_buf, err_size);
                         LOG_W("%s: \"%s\"", err_buf, pattern);
                         g_free(err_buf);
                         return false;
                 }
+        }
 
-                while (true) {
-                        if (regexec(&regex, value, 0, NULL, 0))
-                                break;
-                        regfree(&regex);
-                        return true;
-                }
-                regfree(&regex);
+        p->valid = true;
+        return true;
+}
+
+static void rule_pattern_free(struct rule_pattern *p, enum rule_match_mode mode)
+{
+        g_clear_pointer(&p->source, g_free);
+
+        if (!p->valid)
+                return;
+
+        if (mode == RULE_MATCH_PCRE)
+                g_regex_unref(p->pcre);
+        else if (mode == RULE_MATCH_REGEX)
+                regfree(&p->regex);
+
+        p->valid = false;
+}
+
+static bool rule_pattern_matches(const struct rule_pattern *p, enum rule_match_mode mode, const char *value)
+{
+        // Always match empty pattern
+        if (STR_EMPTY(p->source))
+                return true;
+
+        // Never match null value or a pattern that didn't compile
+        if (!value || !p->valid)
                 return false;
+
+        switch (mode) {
+        case RULE_MATCH_PCRE:
+                return g_regex_match(p->pcre, value, 0, NULL);
+        case RULE_MATCH_REGEX:
+                return !regexec(&p->regex, value, 0, NULL, 0);
+        default:
+                // Fallback to fnmatch if no regex is enabled
+                return !fnmatch(p->source, value, 0);
         }
+}
+
+/*
+ * Match a single value against a pattern, without caching the compiled
+ * pattern. Rules should use their compiled matchers instead.
+ */
+static inline bool rule_field_matches_string(const char *value, const char *pattern)
+{
+        enum rule_match_mode mode = rule_match_mode_get();
+        struct rule_pattern p;
 
-        // Fallback to fnmatch if no regex is enabled
-        return !fnmatch(pattern, value, 0);
+        rule_pattern_compile(&p, pattern, mode);
+        bool matched = rule_pattern_matches(&p, mode, value);
+        rule_pattern_free(&p, mode);
+
+        return matched;
+}
+
+static void rule_matchers_free(struct rule *r)
+{
+        if (!r->matchers)
+                return;
+
+        for (int i = 0; i < RULE_FILTER_COUNT; i++)
+                rule_pattern_free(&r->matchers->patterns[i], r->matchers->mode);
+
+        g_clear_pointer(&r->matchers, g_free);
+}
+
+void rule_invalidate(struct rule *r)
+{
+        rule_matchers_free(r);
+        rule_index_mark_stale();
+}
+
+void rule_compile(struct rule *r)
+{
+        rule_matchers_free(r);
+
+        r->matchers = g_malloc0(sizeof(struct rule_matchers));
+        r->matchers->mode = rule_match_mode_get();
+
+        for (int i = 0; i < RULE_FILTER_COUNT; i++)
+                rule_pattern_compile(&r->matchers->patterns[i], RULE_FILTER(r, i), r->matchers->mode);
+}
+
+void rules_compile_all(void)
+{
+        for (GSList *iter = rules; iter; iter = iter->next)
+                rule_compile(iter->data);
+
+        rule_index_mark_stale();
+}
+
+/*
+ * Match the filter f of r against value, recompiling the pattern in case the
+ * filter was replaced since it was compiled.
+ */
+static bool rule_filter_matches(struct rule *r, enum rule_filter f, const char *value)
+{
+        struct rule_pattern *p = &r->matchers->patterns[f];
+        const char *pattern = RULE_FILTER(r, f);
+
+        // Compare the contents, as a replaced filter may reuse the address
+        // of the freed one
+        if (!STR_EQ(p->source, pattern)) {
+                rule_pattern_free(p, r->matchers->mode);
+                rule_pattern_compile(p, pattern, r->matchers->mode);
+        }
+
+        return rule_pattern_matches(p, r->matchers->mode, value);
 }
 
 /*
@@ -338,17 +477,200 @@ static inline bool rule_field_matches_string(const char *value, const char *patt
  */
 bool rule_matches_notification(struct rule *r, struct notification *n)
 {
-        return  r->enabled
-                && (r->msg_urgency == URG_NONE || r->msg_urgency == n->urgency)
+        if (!r->enabled)
+                return false;
+
+        if (!r->matchers || r->matchers->mode != rule_match_mode_get())
+                rule_compile(r);
+
+        return  (r->msg_urgency == URG_NONE || r->msg_urgency == n->urgency)
                 && (r->match_dbus_timeout < 0 || (r->match_dbus_timeout == n->dbus_timeout))
                 && (r->match_transient == -1 || (r->match_transient == n->transient))
-                && rule_field_matches_string(n->appname,        r->appname)
-                && rule_field_matches_string(n->desktop_entry,  r->desktop_entry)
-                && rule_field_matches_string(n->summary,        r->summary)
-                && rule_field_matches_string(n->body,           r->body)
-                && rule_field_matches_string(n->iconname,       r->icon)
-                && rule_field_matches_string(n->category,       r->category)
-                && rule_field_matches_string(n->stack_tag,      r->stack_tag);
+                && rule_filter_matches(r, RULE_FILTER_APPNAME,       n->appname)
+                && rule_filter_matches(r, RULE_FILTER_DESKTOP_ENTRY, n->desktop_entry)
+                && rule_filter_matches(r, RULE_FILTER_SUMMARY,       n->summary)
+                && rule_filter_matches(r, RULE_FILTER_BODY,          n->body)
+                && rule_filter_matches(r, RULE_FILTER_ICON,          n->iconname)
+                && rule_filter_matches(r, RULE_FILTER_CATEGORY,      n->category)
+                && rule_filter_matches(r, RULE_FILTER_STACK_TAG,     n->stack_tag);
+}
+
+/*
+ * Index of the rules by their literal filters, so that a notification only
+ * has to be matched against the rules which can apply to it.
+ *
+ * Every rule is filed under a single key: its appname if that is a literal,
+ * else its category if that is a literal, else its msg_urgency. All other
+ * rules go to the residual list. The keys refer to sorted positions in
+ * ordered, so that merging them keeps the order of the config.
+ *
+ * Only fnmatch patterns without wildcards are considered literal. Regular
+ * expressions match substrings (and with REG_NEWLINE '^' and '$' match at
+ * every line), so these rules always go to the residual list.
+ */
+static struct {
+        bool valid;
+        enum rule_match_mode mode;
+        GPtrArray *ordered;            //!< All rules in config order
+        GHashTable *appname;           //!< literal appname -> GArray of positions
+        GHashTable *category;          //!< literal category -> GArray of positions
+        GArray *urgency[URG_MAX + 1];  //!< msg_urgency -> positions
+        GArray *residual;              //!< Positions of all other rules
+} rule_index;
+
+static void rule_index_mark_stale(void)
+{
+        rule_index.valid = false;
+}
+
+static void rule_index_free(void)
+{
+        g_clear_pointer(&rule_index.ordered, g_ptr_array_unref);
+        g_clear_pointer(&rule_index.appname, g_hash_table_unref);
+        g_clear_pointer(&rule_index.category, g_hash_table_unref);
+        for (int i = URG_MIN; i <= URG_MAX; i++)
+                g_clear_pointer(&rule_index.urgency[i], g_array_unref);
+        g_clear_pointer(&rule_index.residual, g_array_unref);
+
+        rule_index.valid = false;
+}
+
+/*
+ * Return the only string the pattern can match, or NULL if there are more.
+ */
+static char *rule_pattern_literal(const char *pattern, enum rule_match_mode mode)
+{
+        if (mode != RULE_MATCH_FNMATCH || STR_EMPTY(pattern))
+                return NULL;
+
+        if (strpbrk(pattern, "*?[\\"))
+                return NULL;
+
+        return g_strdup(pattern);
+}
+
+static void rule_index_add(GHashTable *table, char *key, guint pos)
+{
+        GArray *positions = g_hash_table_lookup(table, key);
+
+        if (!positions) {
+                positions = g_array_new(FALSE, FALSE, sizeof(guint));
+                g_hash_table_insert(table, key, positions);
+        } else {
+                g_free(key);
+        }
+
+        g_array_append_val(positions, pos);
+}
+
+static void rule_index_build(void)
+{
+        rule_index_free();
+
+        rule_index.mode = rule_match_mode_get();
+        rule_index.ordered = g_ptr_array_new();
+        rule_index.appname = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify)g_array_unref);
+        rule_index.category = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                    g_free, (GDestroyNotify)g_array_unref);
+        for (int i = URG_MIN; i <= URG_MAX; i++)
+                rule_index.urgency[i] = g_array_new(FALSE, FALSE, sizeof(guint));
+        rule_index.residual = g_array_new(FALSE, FALSE, sizeof(guint));
+
+        for (GSList *iter = rules; iter; iter = iter->next) {
+                struct rule *r = iter->data;
+                guint pos = rule_index.ordered->len;
+                char *literal;
+
+                g_ptr_array_add(rule_index.ordered, r);
+
+                if ((literal = rule_pattern_literal(r->appname, rule_index.mode)))
+                        rule_index_add(rule_index.appname, literal, pos);
+                else if ((literal = rule_pattern_literal(r->category, rule_index.mode)))
+                        rule_index_add(rule_index.category, literal, pos);
+                else if (r->msg_urgency >= URG_MIN && r->msg_urgency <= URG_MAX)
+                        g_array_append_val(rule_index.urgency[r->msg_urgency], pos);
+                else
+                        g_array_append_val(rule_index.residual, pos);
+        }
+
+        rule_index.valid = true;
+        LOG_D("Indexed %u rules, %u of them not by a literal key",
+              rule_index.ordered->len, rule_index.residual->len);
+}
+
+/*
+ * Return the first position in the sorted positions which is not before
+ * from, or G_MAXUINT if there is none.
+ */
+static guint rule_index_next(const GArray *positions, guint from)
+{
+        if (!positions)
+                return G_MAXUINT;
+
+        guint lo = 0, hi = positions->len;
+        while (lo < hi) {
+                guint mid = lo + (hi - lo) / 2;
+                if (g_array_index(positions, guint, mid) < from)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo < positions->len ? g_array_index(positions, guint, lo) : G_MAXUINT;
+}
+
+/*
+ * Whether the index got built from the rules in #rules, as they are now.
+ * The list is changed directly in many places, so this is checked instead
+ * of relying on every change to invalidate the index. Comparing the
+ * pointers is enough, since rule_new() and rule_free() mark the index stale.
+ */
+static bool rule_index_is_current(void)
+{
+        if (!rule_index.valid || rule_index.mode != rule_match_mode_get())
+                return false;
+
+        guint pos = 0;
+        for (const GSList *iter = rules; iter; iter = iter->next, pos++)
+                if (pos >= rule_index.ordered->len || rule_index.ordered->pdata[pos] != iter->data)
+                        return false;
+
+        return pos == rule_index.ordered->len;
+}
+
+/*
+ * Check all rules if they match n and apply.
+ */
+void rule_apply_all(struct notification *n)
+{
+        if (!rule_index_is_current())
+                rule_index_build();
+
+        guint pos = 0;
+        while (true) {
+                // Look the keys up again on every step, since applying a
+                // rule may change the category or urgency of n
+                const GArray *candidates[] = {
+                        n->appname ? g_hash_table_lookup(rule_index.appname, n->appname) : NULL,
+                        n->category ? g_hash_table_lookup(rule_index.category, n->category) : NULL,
+                        n->urgency >= URG_MIN && n->urgency <= URG_MAX ? rule_index.urgency[n->urgency] : NULL,
+                        rule_index.residual,
+                };
+
+                guint next = G_MAXUINT;
+                for (size_t i = 0; i < G_N_ELEMENTS(candidates); i++)
+                        next = MIN(next, rule_index_next(candidates[i], pos));
+
+                if (next == G_MAXUINT)
+                        break;
+
+                struct rule *r = rule_index.ordered->pdata[next];
+                if (rule_matches_notification(r, n)) {
+                        rule_apply(r, n, true);
+                }
+                pos = next + 1;
+        }
 }
 
 /**
@@ -17,6 +17,8 @@
 #include "notification.h"
 #include "settings.h"
 
+struct rule_matchers;
+
 struct rule {
         // Since there's heavy use of offsets from this class, both in rules.c
         // and in settings_data.h the layout of the class should not be
@@ -68,6 +70,9 @@ struct rule {
         bool enabled;
         int progress_bar_alignment;
         char *set_stack_tag; // this has to be the last modifying rule
+
+        // Not a setting. The compiled filters, owned by rules.c
+        struct rule_matchers *matchers;
 };
 
 extern GSList *rules;
@@ -91,6 +96,24 @@ void rule_apply(struct rule *r, struct notification *n, bool save);
 void rule_apply_all(struct notification *n);
 bool rule_matches_notification(struct rule *r, struct notification *n);
 
+/**
+ * Compile the filters of a rule for the current matching mode (fnmatch,
+ * POSIX regex or PCRE), so that matching a notification doesn't have to
+ * compile the patterns again. Invalid patterns are reported once here.
+ */
+void rule_compile(struct rule *r);
+
+/**
+ * Drop the compiled filters of a rule. They are compiled again the next
+ * time the rule is matched. Call this after changing a filter.
+ */
+void rule_invalidate(struct rule *r);
+
+/**
+ * Compile the filters of all rules. Called after the config is loaded.
+ */
+void rules_compile_all(void);
+
 /**
  * Get rule with this name from rules
  *
@@ -0,0 +1,559 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @file
+ * @copyright Copyright 2014-2026 Dunst contributors
+ * @license BSD-3-Clause
+ */
+
+#include "script.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "notification.h"
+#include "settings.h"
+#include "utils.h"
+
+/**
+ * A run of a script waiting to be started
+ */
+struct script_job {
+        char *script;
+        gint id;      /**< Of the notification, to coalesce runs for it */
+        char **argv;
+        char **envp;
+};
+
+/**
+ * A script started once, which gets a record for each run on its stdin
+ */
+struct script_server {
+        char *script;
+        GPid pid;          /**< 0 while not running */
+        int fd;            /**< The stdin of the server, -1 while not running */
+        GString *buffer;   /**< Records not written yet */
+        guint writable;    /**< Waits for the server to read, if the pipe is full */
+        guint child;       /**< Watches the server for exiting */
+        guint restart;     /**< Restarts the server after it exited */
+        gint64 started;
+        gint64 backoff;    /**< The delay for restarting, growing while the server keeps failing */
+        guint dropped;     /**< Records dropped since the server last kept up */
+        bool partial;      /**< The first buffered record got written in part */
+};
+
+/** The maximum size of records a script server is behind */
+#define SCRIPT_SERVER_BUFFER (1024 * 1024)
+#define SCRIPT_SERVER_BACKOFF_MAX S2US(60)
+
+/**
+ * How often a script got started within the current second
+ */
+struct script_limit {
+        gint64 start;
+        int count;
+};
+
+static struct {
+        GQueue waiting;       /**< The struct script_job in the order to start them */
+        guint running;
+        GHashTable *limits;   /**< The struct script_limit of each script */
+        guint retry;          /**< Starts the runs held back by the rate limit */
+        char **base_env;      /**< The environment of dunst, without the `DUNST_*` variables */
+        GHashTable *servers;  /**< The struct script_server of each script */
+} scripts = { G_QUEUE_INIT, 0, NULL, 0, NULL, NULL };
+
+static void scripts_start(void);
+
+static void script_job_free(struct script_job *job)
+{
+        g_free(job->script);
+        g_strfreev(job->argv);
+        g_strfreev(job->envp);
+        g_free(job);
+}
+
+static char **fields_set(char **fields, const char *key, const char *value)
+{
+        return g_environ_setenv(fields, key, value ? value : "", TRUE);
+}
+
+/**
+ * @return (transfer full) the `DUNST_*` variables of the notification as
+ *         `KEY=value` strings
+ */
+static char **script_get_fields(const struct notification *n)
+{
+        char **fields = g_new0(char *, 1);
+        char buf[32];
+
+        fields = fields_set(fields, "DUNST_APP_NAME",  n->appname);
+        fields = fields_set(fields, "DUNST_SUMMARY",   n->summary);
+        fields = fields_set(fields, "DUNST_BODY",      n->body);
+        fields = fields_set(fields, "DUNST_ICON_PATH", n->icon_path);
+        fields = fields_set(fields, "DUNST_URGENCY",   notification_urgency_to_string(n->urgency));
+        g_snprintf(buf, sizeof(buf), "%i", n->id);
+        fields = fields_set(fields, "DUNST_ID",        buf);
+        g_snprintf(buf, sizeof(buf), "%i", n->progress);
+        fields = fields_set(fields, "DUNST_PROGRESS",  buf);
+        fields = fields_set(fields, "DUNST_CATEGORY",  n->category);
+        fields = fields_set(fields, "DUNST_STACK_TAG", n->stack_tag);
+        fields = fields_set(fields, "DUNST_URLS",      n->urls);
+        g_snprintf(buf, sizeof(buf), "%"G_GINT64_FORMAT, n->timeout / 1000);
+        fields = fields_set(fields, "DUNST_TIMEOUT",   buf);
+        g_snprintf(buf, sizeof(buf), "%"G_GINT64_FORMAT, n->timestamp / 1000);
+        fields = fields_set(fields, "DUNST_TIMESTAMP", buf);
+        fields = fields_set(fields, "DUNST_DESKTOP_ENTRY", n->desktop_entry);
+
+        return fields;
+}
+
+static char **script_get_base_env(void)
+{
+        if (!scripts.base_env)
+                scripts.base_env = g_get_environ();
+        return scripts.base_env;
+}
+
+char **script_get_envp(const struct notification *n)
+{
+        char **envp = g_strdupv(script_get_base_env());
+        char **fields = script_get_fields(n);
+
+        for (char **field = fields; *field; field++) {
+                char *value = strchr(*field, '=');
+                *value = '\0';
+                envp = g_environ_setenv(envp, *field, value + 1, TRUE);
+        }
+
+        g_strfreev(fields);
+        return envp;
+}
+
+static void json_append_string(GString *json, const char *str)
+{
+        g_string_append_c(json, '"');
+        for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+                switch (*c) {
+                case '"':
+                        g_string_append(json, "\\\"");
+                        break;
+                case '\\':
+                        g_string_append(json, "\\\\");
+                        break;
+                case '\n':
+                        g_string_append(json, "\\n");
+                        break;
+                case '\t':
+                        g_string_append(json, "\\t");
+                        break;
+                default:
+                        if (*c < 0x20)
+                                g_string_append_printf(json, "\\u%04x", *c);
+                        else
+                                g_string_append_c(json, *c);
+                        break;
+                }
+        }
+        g_string_append_c(json, '"');
+}
+
+/**
+ * @return (transfer full) the fields of the notification as a line
+ *         containing a JSON object, as sent to script servers
+ */
+static char *script_get_record(const struct notification *n)
+{
+        char **fields = script_get_fields(n);
+        GString *record = g_string_new("{");
+
+        for (char **field = fields; *field; field++) {
+                char *value = strchr(*field, '=');
+                *value = '\0';
+                if (field != fields)
+                        g_string_append_c(record, ',');
+                json_append_string(record, *field);
+                g_string_append_c(record, ':');
+                json_append_string(record, value + 1);
+        }
+        g_string_append(record, "}\n");
+
+        g_strfreev(fields);
+        return g_string_free(record, FALSE);
+}
+
+static char **script_get_argv(const char *script, const struct notification *n)
+{
+        char **argv = g_new0(char *, 7);
+        argv[0] = g_strdup(script);
+        argv[1] = g_strdup(n->appname ? n->appname : "");
+        argv[2] = g_strdup(n->summary ? n->summary : "");
+        argv[3] = g_strdup(n->body ? n->body : "");
+        argv[4] = g_strdup(n->iconname ? n->iconname : "");
+        argv[5] = g_strdup(notification_urgency_to_string(n->urgency));
+        return argv;
+}
+
+/**
+ * Count a start of the script against its rate limit
+ *
+ * @param now The current time
+ * @param[out] wait When the script may be started again, if it may not now
+ *
+ * @retval true if the script may be started
+ */
+static bool script_limit_take(const char *script, gint64 now, gint64 *wait)
+{
+        if (settings.script_rate_limit <= 0)
+                return true;
+
+        if (!scripts.limits)
+                scripts.limits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+        struct script_limit *limit = g_hash_table_lookup(scripts.limits, script);
+        if (!limit) {
+                limit = g_new0(struct script_limit, 1);
+                g_hash_table_insert(scripts.limits, g_strdup(script), limit);
+        }
+
+        if (now - limit->start >= S2US(1)) {
+                limit->start = now;
+                limit->count = 0;
+        }
+
+        if (limit->count >= settings.script_rate_limit) {
+                *wait = limit->start + S2US(1) - now;
+                return false;
+        }
+
+        limit->count++;
+        return true;
+}
+
+static void script_exited(GPid pid, gint status, gpointer data)
+{
+        (void)status;
+        (void)data;
+
+        g_spawn_close_pid(pid);
+        scripts.running--;
+        scripts_start();
+}
+
+static void script_job_spawn(struct script_job *job)
+{
+        GPid pid;
+        GError *err = NULL;
+
+        g_spawn_async(NULL,
+                      job->argv,
+                      job->envp,
+                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                      NULL,
+                      NULL,
+                      &pid,
+                      &err);
+
+        if (err) {
+                LOG_W("Unable to run script %s: %s", job->script, err->message);
+                g_error_free(err);
+                return;
+        }
+
+        scripts.running++;
+        g_child_watch_add(pid, script_exited, NULL);
+}
+
+static gboolean scripts_retry(gpointer data)
+{
+        (void)data;
+        scripts.retry = 0;
+        scripts_start();
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Start waiting runs as long as the limits allow it
+ */
+static void scripts_start(void)
+{
+        gint64 now = time_monotonic_now();
+        gint64 retry = -1;
+
+        GList *iter = scripts.waiting.head;
+        while (iter && scripts.running < (guint) MAX(settings.script_max_running, 1)) {
+                GList *next = iter->next;
+                struct script_job *job = iter->data;
+
+                gint64 wait;
+                if (script_limit_take(job->script, now, &wait)) {
+                        g_queue_delete_link(&scripts.waiting, iter);
+                        script_job_spawn(job);
+                        script_job_free(job);
+                } else if (retry < 0 || wait < retry) {
+                        retry = wait;
+                }
+
+                iter = next;
+        }
+
+        if (retry >= 0 && !scripts.retry)
+                scripts.retry = g_timeout_add(MAX(retry / 1000, 1), scripts_retry, NULL);
+}
+
+static void script_server_flush(struct script_server *server);
+
+static void script_server_close(struct script_server *server)
+{
+        if (server->writable) {
+                g_source_remove(server->writable);
+                server->writable = 0;
+        }
+        if (server->fd >= 0) {
+                close(server->fd);
+                server->fd = -1;
+        }
+
+        // The rest of a record makes no sense to the restarted server
+        if (server->partial) {
+                char *end = strchr(server->buffer->str, '\n');
+                g_string_erase(server->buffer, 0, end ? end - server->buffer->str + 1 : -1);
+                server->partial = false;
+        }
+}
+
+static gboolean script_server_restart(gpointer data);
+
+static void script_server_backoff(struct script_server *server)
+{
+        server->backoff = MIN(MAX(server->backoff * 2, S2US(1)), SCRIPT_SERVER_BACKOFF_MAX);
+}
+
+static void script_server_free(struct script_server *server)
+{
+        script_server_close(server);
+
+        if (server->child)
+                g_source_remove(server->child);
+        if (server->restart)
+                g_source_remove(server->restart);
+        if (server->pid)
+                g_spawn_close_pid(server->pid);
+
+        g_string_free(server->buffer, TRUE);
+        g_free(server->script);
+        g_free(server);
+}
+
+static void script_server_exited(GPid pid, gint status, gpointer data)
+{
+        struct script_server *server = data;
+        gint64 now = time_monotonic_now();
+
+        g_spawn_close_pid(pid);
+        server->pid = 0;
+        server->child = 0;
+        script_server_close(server);
+
+        // Back off while the server keeps failing right after starting
+        if (now - server->started < S2US(1))
+                script_server_backoff(server);
+        else
+                server->backoff = 0;
+
+        LOG_W("Script server %s exited with status %d, restarting in %"G_GINT64_FORMAT" ms",
+              server->script, status, server->backoff / 1000);
+        server->restart = g_timeout_add(server->backoff / 1000, script_server_restart, server);
+}
+
+static bool script_server_start(struct script_server *server)
+{
+        char *argv[] = { server->script, NULL };
+        GError *err = NULL;
+
+        g_spawn_async_with_pipes(NULL,
+                                 argv,
+                                 script_get_base_env(),
+                                 G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                 NULL,
+                                 NULL,
+                                 &server->pid,
+                                 &server->fd,
+                                 NULL,
+                                 NULL,
+                                 &err);
+
+        if (err) {
+                LOG_W("Unable to start script server %s: %s", server->script, err->message);
+                g_error_free(err);
+                server->pid = 0;
+                server->fd = -1;
+
+                script_server_backoff(server);
+                server->restart = g_timeout_add(server->backoff / 1000, script_server_restart, server);
+                return false;
+        }
+
+        // Records get written as far as the server keeps up
+        g_unix_set_fd_nonblocking(server->fd, TRUE, NULL);
+        server->started = time_monotonic_now();
+        server->child = g_child_watch_add(server->pid, script_server_exited, server);
+        LOG_D("Started script server %s", server->script);
+        return true;
+}
+
+static gboolean script_server_restart(gpointer data)
+{
+        struct script_server *server = data;
+        server->restart = 0;
+
+        if (script_server_start(server))
+                script_server_flush(server);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean script_server_writable(gint fd, GIOCondition condition, gpointer data)
+{
+        struct script_server *server = data;
+        server->writable = 0;
+        script_server_flush(server);
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Write the buffered records, as far as the pipe takes them
+ */
+static void script_server_flush(struct script_server *server)
+{
+        while (server->fd >= 0 && server->buffer->len > 0) {
+                ssize_t written = write(server->fd, server->buffer->str, server->buffer->len);
+                int error = errno;
+
+                if (written > 0) {
+                        server->partial = server->buffer->str[written - 1] != '\n';
+                        g_string_erase(server->buffer, 0, written);
+                } else if (error == EAGAIN || error == EWOULDBLOCK) {
+                        if (!server->writable)
+                                server->writable = g_unix_fd_add(server->fd, G_IO_OUT,
+                                                                 script_server_writable, server);
+                        return;
+                } else if (error == EPIPE) {
+                        // The child watch restarts the server that went away
+                        LOG_D("Script server %s closed its input", server->script);
+                        script_server_close(server);
+                        return;
+                } else if (error != EINTR) {
+                        LOG_W("Unable to write to script server %s: %s", server->script, strerror(error));
+                        script_server_close(server);
+                        return;
+                }
+        }
+
+        if (server->buffer->len == 0 && server->dropped) {
+                LOG_W("Script server %s caught up, %u notifications were dropped",
+                      server->script, server->dropped);
+                server->dropped = 0;
+        }
+}
+
+/**
+ * Send the notification to the server of the script, starting it if needed
+ */
+static void script_server_send(const char *script, const struct notification *n)
+{
+        if (!scripts.servers)
+                scripts.servers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                                        (GDestroyNotify) script_server_free);
+
+        struct script_server *server = g_hash_table_lookup(scripts.servers, script);
+        if (!server) {
+                server = g_new0(struct script_server, 1);
+                server->script = g_strdup(script);
+                server->fd = -1;
+                server->buffer = g_string_new(NULL);
+                g_hash_table_insert(scripts.servers, server->script, server);
+        }
+
+        char *record = script_get_record(n);
+        if (server->buffer->len + strlen(record) > SCRIPT_SERVER_BUFFER) {
+                if (!server->dropped++)
+                        LOG_W("Script server %s does not keep up, dropping notifications", script);
+                g_free(record);
+                return;
+        }
+        g_string_append(server->buffer, record);
+        g_free(record);
+
+        if (!server->pid && !server->restart) {
+                script_server_restart(server);
+        } else if (!server->writable) {
+                script_server_flush(server);
+        }
+}
+
+void script_run(const char *script, const struct notification *n)
+{
+        if (settings.script_server) {
+                script_server_send(script, n);
+                return;
+        }
+
+        // A run for the notification still waiting only gets the new values
+        for (GList *iter = scripts.waiting.head; iter; iter = iter->next) {
+                struct script_job *job = iter->data;
+                if (job->id == n->id && STR_EQ(job->script, script)) {
+                        LOG_D("Coalescing runs of script %s for notification %d", script, n->id);
+                        g_strfreev(job->argv);
+                        g_strfreev(job->envp);
+                        job->argv = script_get_argv(script, n);
+                        job->envp = script_get_envp(n);
+                        return;
+                }
+        }
+
+        if (scripts.waiting.length >= (guint) MAX(settings.script_queue_size, 1)) {
+                struct script_job *dropped = g_queue_pop_head(&scripts.waiting);
+                LOG_W("Too many scripts waiting, dropping the run of %s for notification %d",
+                      dropped->script, dropped->id);
+                script_job_free(dropped);
+        }
+
+        struct script_job *job = g_new0(struct script_job, 1);
+        job->script = g_strdup(script);
+        job->id = n->id;
+        job->argv = script_get_argv(script, n);
+        job->envp = script_get_envp(n);
+        g_queue_push_tail(&scripts.waiting, job);
+
+        scripts_start();
+}
+
+guint script_queue_length(void)
+{
+        return scripts.waiting.length;
+}
+
+guint script_running(void)
+{
+        return scripts.running;
+}
+
+void script_teardown(void)
+{
+        struct script_job *job;
+        while ((job = g_queue_pop_head(&scripts.waiting)))
+                script_job_free(job);
+
+        if (scripts.retry) {
+                g_source_remove(scripts.retry);
+                scripts.retry = 0;
+        }
+
+        g_clear_pointer(&scripts.limits, g_hash_table_unref);
+        g_clear_pointer(&scripts.servers, g_hash_table_unref);
+        g_clear_pointer(&scripts.base_env, g_strfreev);
+}
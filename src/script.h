@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/**
+ * @file
+ * @ingroup notify
+ * @brief Running the scripts of notifications
+ * @copyright Copyright 2014-2026 Dunst contributors
+ * @license BSD-3-Clause
+ *
+ * Scripts get spawned asynchronously from a queue. Only a limited number
+ * of them runs at a time and each script is started a limited number of
+ * times per second. Runs for a notification still waiting in the queue get
+ * coalesced and the oldest runs are dropped when the queue is full, so a
+ * storm of notifications can't stall dunst or the machine.
+ */
+
+#ifndef DUNST_SCRIPT_H
+#define DUNST_SCRIPT_H
+
+#include <glib.h>
+
+#include "notification.h"
+
+/**
+ * Queue a run of the script for the notification. The arguments and the
+ * environment get taken from the notification right away.
+ *
+ * @param script The path or name of the executable
+ * @param n The notification
+ */
+void script_run(const char *script, const struct notification *n);
+
+/**
+ * Build the environment variables passed to scripts
+ *
+ * @param n The notification
+ *
+ * @return (transfer full) the environment of dunst with the `DUNST_*`
+ *         variables of the notification set
+ */
+char **script_get_envp(const struct notification *n);
+
+/**
+ * @return the number of script runs waiting to be started
+ */
+guint script_queue_length(void);
+
+/**
+ * @return the number of scripts running
+ */
+guint script_running(void);
+
+/**
+ * Drop the waiting script runs
+ */
+void script_teardown(void);
+
+#endif
@@ -18,6 +18,7 @@
 #include "dunst.h"
 #include "log.h"
 #include "option_parser.h"
+#include "rules.h"
 #include "utils.h"
 
 #ifndef SYSCONFDIR
@@ -287,6 +288,11 @@ void load_settings(char **const paths)
         if (0 == n_loaded_confs)
                 LOG_M("No configuration file found, using defaults");
 
+        // Compile the rule filters only now, as enable_regex and
+        // enable_pcre_regex may be set by any of the files
+        LOG_D("Compiling rules");
+        rules_compile_all();
+
         g_ptr_array_unref(conf_files);
 }
 
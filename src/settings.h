@@ -131,10 +131,14 @@ struct settings {
         enum sort_type sort;
         int indicate_hidden;
         gint64 idle_threshold;
+        gint64 coalesce_interval;
         gint64 show_age_threshold;
         enum alignment align;
         int sticky_history;
         int history_length;
+        bool history_compact;
+        bool history_persist;
+        int icon_cache_size;
         int show_indicators;
         int ignore_dbusclose;
         int ignore_newline;
@@ -162,6 +166,10 @@ struct settings {
         char *icon_path;
         enum follow_mode f_mode;
         bool always_run_script;
+        int script_max_running;
+        int script_queue_size;
+        int script_rate_limit;
+        bool script_server;
         struct keyboard_shortcut close_ks;
         struct keyboard_shortcut close_all_ks;
         struct keyboard_shortcut history_ks;
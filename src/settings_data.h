@@ -962,6 +962,16 @@ static const struct setting allowed_settings[] = {
                 .parser = NULL,
                 .parser_data = NULL,
         },
+        {
+                .name = "coalesce_interval",
+                .section = "global",
+                .description = "The minimum time between updates of the notifications in a burst",
+                .type = TYPE_TIME,
+                .default_value = "16ms",
+                .value = &settings.coalesce_interval,
+                .parser = NULL,
+                .parser_data = NULL,
+        },
         {
                 .name = "monitor",
                 .section = "global",
@@ -1052,6 +1062,26 @@ static const struct setting allowed_settings[] = {
                 .parser = NULL,
                 .parser_data = NULL,
         },
+        {
+                .name = "history_compact",
+                .section = "global",
+                .description = "Share icons and drop rendered text of notifications in history",
+                .type = TYPE_CUSTOM,
+                .default_value = "false",
+                .value = &settings.history_compact,
+                .parser = string_parse_bool,
+                .parser_data = boolean_enum_data,
+        },
+        {
+                .name = "history_persist",
+                .section = "global",
+                .description = "Keep the history across restarts",
+                .type = TYPE_CUSTOM,
+                .default_value = "false",
+                .value = &settings.history_persist,
+                .parser = string_parse_bool,
+                .parser_data = boolean_enum_data,
+        },
         {
                 .name = "show_indicators",
                 .section = "global",
@@ -1232,6 +1262,46 @@ static const struct setting allowed_settings[] = {
                 .parser = string_parse_bool,
                 .parser_data = boolean_enum_data,
         },
+        {
+                .name = "script_max_running",
+                .section = "global",
+                .description = "The maximum number of scripts running at the same time",
+                .type = TYPE_INT,
+                .default_value = "8",
+                .value = &settings.script_max_running,
+                .parser = NULL,
+                .parser_data = NULL,
+        },
+        {
+                .name = "script_queue_size",
+                .section = "global",
+                .description = "The maximum number of script runs waiting to be started",
+                .type = TYPE_INT,
+                .default_value = "128",
+                .value = &settings.script_queue_size,
+                .parser = NULL,
+                .parser_data = NULL,
+        },
+        {
+                .name = "script_rate_limit",
+                .section = "global",
+                .description = "How often each script may be started per second, 0 for no limit",
+                .type = TYPE_INT,
+                .default_value = "20",
+                .value = &settings.script_rate_limit,
+                .parser = NULL,
+                .parser_data = NULL,
+        },
+        {
+                .name = "script_server",
+                .section = "global",
+                .description = "Start each script once and send it the notifications on its standard input",
+                .type = TYPE_CUSTOM,
+                .default_value = "false",
+                .value = &settings.script_server,
+                .parser = string_parse_bool,
+                .parser_data = boolean_enum_data,
+        },
         {
                 .name = "gap_size",
                 .section = "global",
@@ -1374,6 +1444,16 @@ static const struct setting allowed_settings[] = {
                 .parser_data = boolean_enum_data,
                 .different_default = true,
         },
+        {
+                .name = "icon_cache_size",
+                .section = "global",
+                .description = "Memory budget in KiB for caching decoded icons",
+                .type = TYPE_INT,
+                .default_value = "8192",
+                .value = &settings.icon_cache_size,
+                .parser = NULL,
+                .parser_data = NULL,
+        },
         {
                 .name = "enable_posix_regex",
                 .section = "global",
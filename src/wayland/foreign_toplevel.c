@@ -107,11 +107,11 @@ static void toplevel_handle_done(void *data,
         (void)zwlr_toplevel;
         struct toplevel_v1 *toplevel = data;
 
-        bool was_fullscreen = wl_have_fullscreen_window();
         copy_state(&toplevel->current, &toplevel->pending);
         bool is_fullscreen = wl_have_fullscreen_window();
 
-        if (was_fullscreen != is_fullscreen) {
+        if (dunst_status_get().fullscreen != is_fullscreen) {
+                dunst_status(S_FULLSCREEN, is_fullscreen);
                 wake_up();
         }
 }
@@ -130,6 +130,12 @@ static void toplevel_handle_closed(void *data,
 
         g_free(toplevel);
         zwlr_foreign_toplevel_handle_v1_destroy(zwlr_toplevel);
+
+        bool is_fullscreen = wl_have_fullscreen_window();
+        if (dunst_status_get().fullscreen != is_fullscreen) {
+                dunst_status(S_FULLSCREEN, is_fullscreen);
+                wake_up();
+        }
 }
 
 static void toplevel_handle_title(void *data,
@@ -16,6 +16,7 @@
 #include <string.h>
 
 #include "pool-buffer.h"
+#include "../log.h"
 #include "../utils.h"
 
 /**
@@ -64,6 +65,17 @@ static int create_shm_file(off_t size)
         return fd;
 }
 
+/** The smallest size class, sizes above get rounded up to a power of two */
+#define POOL_MIN_CLASS 4096
+
+static size_t size_class(size_t size)
+{
+        size_t class = POOL_MIN_CLASS;
+        while (class < size)
+                class *= 2;
+        return class;
+}
+
 static void buffer_handle_release(void *data, struct wl_buffer *wl_buffer)
 {
         struct pool_buffer *buffer = data;
@@ -74,87 +86,186 @@ static const struct wl_buffer_listener buffer_listener = {
         .release = buffer_handle_release,
 };
 
-static struct pool_buffer *create_buffer(struct wl_shm *shm, struct pool_buffer *buf,
-                                         int32_t width, int32_t height)
+static void buffer_unmap(struct pool_buffer *buf)
+{
+        if (buf->cairo)
+                cairo_destroy(buf->cairo);
+
+        if (buf->surface)
+                cairo_surface_destroy(buf->surface);
+
+        buf->cairo = NULL;
+        buf->surface = NULL;
+}
+
+/**
+ * Create the cairo surface of the buffer on the memory mapped currently
+ */
+static void buffer_map(struct shm_pool *pool, struct pool_buffer *buf)
 {
-        const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
         const cairo_format_t cairo_fmt = CAIRO_FORMAT_ARGB32;
+        uint32_t stride = cairo_format_stride_for_width(cairo_fmt, buf->width);
 
-        uint32_t stride = cairo_format_stride_for_width(cairo_fmt, width);
-        size_t size = stride * height;
+        buffer_unmap(buf);
+        buf->surface = cairo_image_surface_create_for_data((unsigned char *) pool->data + buf->offset,
+                                                           cairo_fmt, buf->width, buf->height, stride);
+        buf->cairo = cairo_create(buf->surface);
+}
 
-        void *data = NULL;
-        if (size > 0) {
-                int fd = create_shm_file(size);
-                if (fd == -1) {
-                        return NULL;
-                }
+/**
+ * Resize the pool and map it again. The contents stay, but the buffers
+ * get new cairo surfaces.
+ */
+static bool pool_resize(struct wl_shm *shm, struct shm_pool *pool, size_t size)
+{
+        if (!pool->pool) {
+                pool->fd = create_shm_file(size);
+                if (pool->fd == -1)
+                        return false;
+        } else if (ftruncate(pool->fd, size) < 0) {
+                return false;
+        }
 
-                data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-                if (data == MAP_FAILED) {
-                        close(fd);
-                        return NULL;
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+        if (data == MAP_FAILED) {
+                if (!pool->pool) {
+                        close(pool->fd);
+                        pool->fd = -1;
                 }
+                return false;
+        }
+
+        if (pool->pool) {
+                wl_shm_pool_resize(pool->pool, size);
+                munmap(pool->data, pool->size);
+        } else {
+                pool->pool = wl_shm_create_pool(shm, pool->fd, size);
+        }
 
-                struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-                buf->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, wl_fmt);
-                wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
-                wl_shm_pool_destroy(pool);
+        LOG_D("Wayland: Resized shm pool from %zu to %zu bytes", pool->size, size);
+        pool->data = data;
+        pool->size = size;
 
-                close(fd);
+        for (size_t i = 0; i < POOL_BUFFERS; i++) {
+                if (pool->buffers[i].buffer)
+                        buffer_map(pool, &pool->buffers[i]);
         }
+        return true;
+}
 
-        buf->data = data;
-        buf->size = size;
-        buf->width = width;
-        buf->height = height;
-        buf->surface = cairo_image_surface_create_for_data(data, cairo_fmt, width, height, stride);
-        buf->cairo = cairo_create(buf->surface);
-        buf->pango = pango_cairo_create_context(buf->cairo);
-        return buf;
+static bool range_is_free(const struct shm_pool *pool, size_t offset, size_t size)
+{
+        for (size_t i = 0; i < POOL_BUFFERS; i++) {
+                const struct pool_buffer *buf = &pool->buffers[i];
+                if (buf->capacity && offset < buf->offset + buf->capacity && buf->offset < offset + size)
+                        return false;
+        }
+        return true;
 }
 
-void finish_buffer(struct pool_buffer *buffer)
+/**
+ * Find a free range in the pool, growing it if none fits
+ *
+ * @return the offset of the range or -1 if the pool could not grow
+ */
+static ssize_t pool_alloc(struct wl_shm *shm, struct shm_pool *pool, size_t size)
+{
+        size_t end = 0;
+
+        if (size <= pool->size && range_is_free(pool, 0, size))
+                return 0;
+
+        // Free ranges can only start where another buffer ends
+        for (size_t i = 0; i < POOL_BUFFERS; i++) {
+                const struct pool_buffer *buf = &pool->buffers[i];
+                if (!buf->capacity)
+                        continue;
+
+                size_t offset = buf->offset + buf->capacity;
+                end = MAX(end, offset);
+                if (offset + size <= pool->size && range_is_free(pool, offset, size))
+                        return offset;
+        }
+
+        // Grow generously, as the other buffers will follow in the same size
+        if (!pool_resize(shm, pool, MAX(end + size, pool->size * 2)))
+                return -1;
+
+        return end;
+}
+
+static void finish_buffer(struct pool_buffer *buffer)
 {
         if (buffer->buffer)
                 wl_buffer_destroy(buffer->buffer);
 
-        if (buffer->cairo)
-                cairo_destroy(buffer->cairo);
+        buffer_unmap(buffer);
 
-        if (buffer->surface)
-                cairo_surface_destroy(buffer->surface);
+        memset(buffer, 0, sizeof(struct pool_buffer));
+}
 
-        if (buffer->pango)
-                g_object_unref(buffer->pango);
+void finish_pool(struct shm_pool *pool)
+{
+        for (size_t i = 0; i < POOL_BUFFERS; i++)
+                finish_buffer(&pool->buffers[i]);
 
-        if (buffer->data)
-                munmap(buffer->data, buffer->size);
+        if (pool->pool) {
+                wl_shm_pool_destroy(pool->pool);
+                munmap(pool->data, pool->size);
+                close(pool->fd);
+        }
 
-        memset(buffer, 0, sizeof(struct pool_buffer));
+        memset(pool, 0, sizeof(struct shm_pool));
 }
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm, struct pool_buffer pool[static 2],
+struct pool_buffer *get_next_buffer(struct wl_shm *shm, struct shm_pool *pool,
                                     uint32_t width, uint32_t height)
 {
+        const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
+        const cairo_format_t cairo_fmt = CAIRO_FORMAT_ARGB32;
+
+        uint32_t stride = cairo_format_stride_for_width(cairo_fmt, width);
+        size_t size = (size_t) stride * height;
         struct pool_buffer *buffer = NULL;
 
-        for (size_t i = 0; i < 2; ++i) {
-                if (pool[i].busy)
+        // Prefer a free buffer of the same size, then one with enough memory
+        for (size_t i = 0; i < POOL_BUFFERS; ++i) {
+                struct pool_buffer *buf = &pool->buffers[i];
+                if (buf->busy)
                         continue;
-                buffer = &pool[i];
+
+                if (buf->buffer && buf->width == width && buf->height == height)
+                        return buf;
+
+                if (!buffer || (buf->capacity >= size && buffer->capacity < size))
+                        buffer = buf;
         }
 
-        if (!buffer)
+        if (!buffer || size == 0)
                 return NULL;
 
-        if (buffer->width != width || buffer->height != height)
-                finish_buffer(buffer);
+        if (buffer->buffer) {
+                wl_buffer_destroy(buffer->buffer);
+                buffer->buffer = NULL;
+        }
 
-        if (!buffer->buffer) {
-                if (!create_buffer(shm, buffer, width, height))
+        // Only sizes outgrowing the size class need new memory
+        if (buffer->capacity < size) {
+                buffer->capacity = 0;
+                ssize_t offset = pool_alloc(shm, pool, size_class(size));
+                if (offset < 0) {
+                        finish_buffer(buffer);
                         return NULL;
+                }
+                buffer->offset = offset;
+                buffer->capacity = size_class(size);
         }
 
+        buffer->width = width;
+        buffer->height = height;
+        buffer->buffer = wl_shm_pool_create_buffer(pool->pool, buffer->offset, width, height, stride, wl_fmt);
+        wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+        buffer_map(pool, buffer);
+
         return buffer;
 }
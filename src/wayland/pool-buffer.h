@@ -16,20 +16,43 @@
 #include <stdint.h>
 #include <wayland-client.h>
 
+/** How many buffers are kept, as the compositor may hold one while another is pending */
+#define POOL_BUFFERS 3
+
 struct pool_buffer {
         struct wl_buffer *buffer;
         cairo_surface_t *surface;
         cairo_t *cairo;
-        PangoContext *pango;
         uint32_t width, height;
+        size_t offset;   /**< Of the memory of the buffer in the pool */
+        size_t capacity; /**< Reserved in the pool, rounded up to a size class */
+        bool busy;
+};
+
+/**
+ * A single growable shared memory pool, which the buffers get allocated in
+ */
+struct shm_pool {
+        struct wl_shm_pool *pool;
+        int fd;
         void *data;
         size_t size;
-        bool busy;
+        struct pool_buffer buffers[POOL_BUFFERS];
 };
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm, struct pool_buffer pool[static 2],
+/**
+ * Get a buffer the compositor does not hold, to render the next frame of
+ * the given size into. Buffers get reused as long as the size fits into
+ * their size class, and the pool only grows when no free range fits.
+ *
+ * @return the buffer or NULL if no buffer is free or allocating it failed
+ */
+struct pool_buffer *get_next_buffer(struct wl_shm *shm, struct shm_pool *pool,
                                     uint32_t width, uint32_t height);
 
-void finish_buffer(struct pool_buffer *buffer);
+/**
+ * Destroy all buffers and the pool
+ */
+void finish_pool(struct shm_pool *pool);
 
 #endif
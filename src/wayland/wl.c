@@ -70,6 +70,10 @@ static const struct wl_surface_listener surface_listener = {
 static void schedule_frame_and_commit(void);
 static void send_frame(void);
 
+static void damage_all(void) {
+        g_clear_pointer(&ctx.damage, cairo_region_destroy);
+}
+
 static void layer_surface_handle_configure(void *data,
                 struct zwlr_layer_surface_v1 *surface,
                 uint32_t serial, uint32_t width, uint32_t height) {
@@ -86,6 +90,7 @@ static void layer_surface_handle_configure(void *data,
         ctx.width = width;
         ctx.height = height;
 
+        damage_all();
         send_frame();
 }
 
@@ -101,6 +106,7 @@ static void xdg_surface_handle_configure(void *data,
 
         ctx.configured = true;
 
+        damage_all();
         send_frame();
 }
 
@@ -422,9 +428,10 @@ void wl_deinit(void) {
         if (ctx.surface != NULL) {
                 g_clear_pointer(&ctx.surface, wl_surface_destroy);
         }
-        finish_buffer(&ctx.buffers[0]);
-        finish_buffer(&ctx.buffers[1]);
+        finish_pool(&ctx.pool);
         ctx.current_buffer = NULL;
+        g_clear_pointer(&ctx.layout_ctx, cairo_destroy);
+        damage_all();
 
         // The output list is initialized at the start of init, so no need to
         // check for NULL
@@ -522,9 +529,15 @@ static void send_frame(void) {
                         wl_surface_destroy(ctx.surface);
                         ctx.surface = NULL;
                 }
+                // The callback of a destroyed surface might never be done
+                if (ctx.frame_callback != NULL) {
+                        wl_callback_destroy(ctx.frame_callback);
+                        ctx.frame_callback = NULL;
+                }
                 ctx.width = ctx.height = 0;
                 ctx.surface_output = NULL;
                 ctx.configured = false;
+                damage_all();
         }
 
         {
@@ -596,7 +609,7 @@ static void send_frame(void) {
         // We only do this for layer_surface, as xdg_surface only needs configuration
         // using xdg_surface_set_window_geometry if it differs from the buffer dimension.
         // Furthermore mutter intersects the buffer dimension and the window geometry.
-        // As we directly do a commit+roundtrip, mutter will complain, as the missing
+        // As we directly do a commit, mutter will complain, as the missing
         // buffer causes a 0,0 intersection and also causes a size of 0,0 in the
         // configure event.
         if (ctx.layer_surface && (ctx.height != height || ctx.width != width)) {
@@ -639,7 +652,8 @@ static void send_frame(void) {
                 // layer surface will exist and the height will hopefully match what
                 // we asked for. That means we won't return here, and will actually
                 // draw into the surface down below.
-                wl_display_roundtrip(ctx.display);
+                // The state stays dirty meanwhile, so draws happening until then
+                // only replace the buffer to attach.
                 return;
         }
 
@@ -647,10 +661,23 @@ static void send_frame(void) {
 
         // Yay we can finally draw something!
         wl_surface_set_buffer_scale(ctx.surface, scale);
-        wl_surface_damage_buffer(ctx.surface, 0, 0, INT32_MAX, INT32_MAX);
+        if (ctx.damage) {
+                int n = cairo_region_num_rectangles(ctx.damage);
+                for (int i = 0; i < n; i++) {
+                        cairo_rectangle_int_t rect;
+                        cairo_region_get_rectangle(ctx.damage, i, &rect);
+                        wl_surface_damage_buffer(ctx.surface, rect.x, rect.y, rect.width, rect.height);
+                }
+        } else {
+                wl_surface_damage_buffer(ctx.surface, 0, 0, INT32_MAX, INT32_MAX);
+        }
         wl_surface_attach(ctx.surface, ctx.current_buffer->buffer, 0, 0);
         ctx.current_buffer->busy = true;
 
+        // Only the changes of the following frames have to be damaged
+        damage_all();
+        ctx.damage = cairo_region_create();
+
         // Schedule a frame in case the state becomes dirty again
         schedule_frame_and_commit();
 
@@ -716,43 +743,67 @@ void wl_win_hide(window win) {
         LOG_I("Wayland: Hiding window");
         ctx.cur_dim.h = 0;
         set_dirty();
-        wl_display_roundtrip(ctx.display);
 }
 
 void wl_display_surface(cairo_surface_t *srf, window winptr, const struct dimensions* dim) {
         /* struct window_wl *win = (struct window_wl*)winptr; */
         int scale = wl_get_scale();
-        LOG_D("Buffer size (scaled) %ix%i", dim->w * scale, dim->h * scale);
-        ctx.current_buffer = get_next_buffer(ctx.shm, ctx.buffers,
-                        dim->w * scale, dim->h * scale);
 
-        if(ctx.current_buffer == NULL) {
-                return;
+        // Copy the frame only if it did not get rendered into the buffer
+        if (!ctx.current_buffer || srf != ctx.current_buffer->surface) {
+                LOG_D("Buffer size (scaled) %ix%i", dim->w * scale, dim->h * scale);
+                ctx.current_buffer = get_next_buffer(ctx.shm, &ctx.pool,
+                                dim->w * scale, dim->h * scale);
+
+                if(ctx.current_buffer == NULL) {
+                        return;
+                }
+
+                cairo_t *c = ctx.current_buffer->cairo;
+                cairo_save(c);
+                cairo_set_source_surface(c, srf, 0, 0);
+                cairo_rectangle(c, 0, 0, dim->w * scale, dim->h * scale);
+                cairo_fill(c);
+                cairo_restore(c);
         }
 
-        cairo_t *c = ctx.current_buffer->cairo;
-        cairo_save(c);
-        cairo_set_source_surface(c, srf, 0, 0);
-        cairo_rectangle(c, 0, 0, dim->w * scale, dim->h * scale);
-        cairo_fill(c);
-        cairo_restore(c);
+        if (ctx.damage && dim->damage && dim->w == ctx.cur_dim.w && dim->h == ctx.cur_dim.h)
+                cairo_region_union(ctx.damage, dim->damage);
+        else
+                damage_all();
 
         ctx.cur_dim = *dim;
+        ctx.cur_dim.damage = NULL;
 
+        // Commits get flushed by the event source before polling, and draws
+        // happening while a frame callback is pending end up in one commit
         set_dirty();
-        wl_display_roundtrip(ctx.display);
+}
+
+cairo_surface_t* wl_win_get_buffer(window winptr, int width, int height) {
+        LOG_D("Buffer size (scaled) %ix%i", width, height);
+        ctx.current_buffer = get_next_buffer(ctx.shm, &ctx.pool, width, height);
+
+        if (ctx.current_buffer == NULL) {
+                return NULL;
+        }
+
+        return ctx.current_buffer->surface;
 }
 
 cairo_t* wl_win_get_context(window winptr) {
         struct window_wl *win = (struct window_wl*)winptr;
-        ctx.current_buffer = get_next_buffer(ctx.shm, ctx.buffers, 500, 500);
 
-        if(ctx.current_buffer == NULL) {
-                return NULL;
+        // The context is only used for laying out text, so it does not need
+        // a buffer shared with the compositor
+        if (!ctx.layout_ctx) {
+                cairo_surface_t *srf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+                ctx.layout_ctx = cairo_create(srf);
+                cairo_surface_destroy(srf);
         }
 
-        win->c_surface = ctx.current_buffer->surface;
-        win->c_ctx = ctx.current_buffer->cairo;
+        win->c_surface = cairo_get_target(ctx.layout_ctx);
+        win->c_ctx = ctx.layout_ctx;
         return win->c_ctx;
 }
 
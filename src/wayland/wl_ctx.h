@@ -54,10 +54,12 @@ struct wl_ctx {
         bool dirty;
 
         struct dimensions cur_dim;
+        cairo_region_t *damage; /**< Changed since the last commit in buffer pixels, NULL for all */
 
         int32_t width, height;
-        struct pool_buffer buffers[2];
+        struct shm_pool pool;
         struct pool_buffer *current_buffer;
+        cairo_t *layout_ctx; /**< To lay out text, without a buffer */
         struct wl_cursor_theme *cursor_theme;
         const struct wl_cursor_image *cursor_image;
         struct wl_surface *cursor_surface;
@@ -41,6 +41,9 @@ static void output_handle_name(void *data, struct wl_output *wl_output,
         struct dunst_output *output = data;
         output->name = g_strdup(name);
         LOG_D("Output global %" PRIu32 " name %s", output->global_name, name);
+
+        // It may be the output configured to show the notifications on
+        dunst_status_invalidate(S_FULLSCREEN);
 }
 
 static void output_handle_description(void *data, struct wl_output *output, const char* description) {
@@ -108,4 +111,6 @@ void destroy_output(struct dunst_output *output) {
         wl_output_destroy(output->wl_output);
         g_free(output->name);
         g_free(output);
+
+        dunst_status_invalidate(S_FULLSCREEN);
 }
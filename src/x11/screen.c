@@ -35,6 +35,19 @@ bool dunst_follow_errored = false;
 static int randr_major_version = 0;
 static int randr_minor_version = 0;
 
+/** The index of the active screen in #screens or -1, if it has to be looked up */
+static int active_screen = -1;
+
+/**
+ * The focused window, which PropertyNotify events get selected for to notice
+ * when it enters or leaves fullscreen
+ */
+static struct {
+        Window window;
+        long mask;       /**< The events selected before */
+        Atom wm_state;
+} watched;
+
 void randr_init(void);
 void randr_update(void);
 void xinerama_update(void);
@@ -102,6 +115,10 @@ double screen_dpi_get(const struct screen_info *scr)
 
 void init_screens(void)
 {
+        // The windows of a previous connection are gone
+        watched.window = 0;
+        watched.wm_state = XInternAtom(xctx.dpy, "_NET_WM_STATE", False);
+
         if (settings.force_xinerama) {
                 xinerama_update();
         } else {
@@ -127,6 +144,7 @@ void alloc_screen_ar(int n)
         free_screen_ar(screens, screens_len);
         screens = g_malloc0(n * sizeof(struct screen_info));
         screens_len = n;
+        active_screen = -1;
 }
 
 void randr_init(void)
@@ -234,14 +252,56 @@ void screen_update_fallback(void)
         screens[0].h = DisplayHeight(xctx.dpy, screen);
 }
 
+/**
+ * X11 ErrorHandler to mainly discard BadWindow parameter error
+ */
+static int XErrorHandlerFullscreen(Display *display, XErrorEvent *e);
+
+/**
+ * Select the PropertyNotify events of window instead of the previously
+ * watched one, on which the events selected before get restored
+ */
+static void screen_watch_window(Window window)
+{
+        if (window == watched.window)
+                return;
+
+        XFlush(xctx.dpy);
+        XSetErrorHandler(XErrorHandlerFullscreen);
+
+        if (watched.window)
+                XSelectInput(xctx.dpy, watched.window, watched.mask);
+
+        XWindowAttributes attr;
+        if (window && XGetWindowAttributes(xctx.dpy, window, &attr)) {
+                watched.window = window;
+                watched.mask = attr.your_event_mask;
+                XSelectInput(xctx.dpy, window, attr.your_event_mask | PropertyChangeMask);
+        } else {
+                watched.window = 0;
+        }
+
+        XSync(xctx.dpy, false);
+        XSetErrorHandler(NULL);
+}
+
 bool have_fullscreen_window(void)
 {
-        return window_is_fullscreen(get_focused_window());
+        Window focused = get_focused_window();
+        screen_watch_window(focused);
+        return window_is_fullscreen(focused);
+}
+
+bool screen_is_state_change(const XPropertyEvent *ev)
+{
+        return ev->window != watched.window || ev->atom == watched.wm_state;
+}
+
+void screen_forget_active(void)
+{
+        active_screen = -1;
 }
 
-/**
- * X11 ErrorHandler to mainly discard BadWindow parameter error
- */
 static int XErrorHandlerFullscreen(Display *display, XErrorEvent *e)
 {
         /* Ignore BadWindow errors. Window may have been gone */
@@ -333,7 +393,7 @@ static int get_screen_by_name(const char *name, int defval)
  * Select the screen on which the Window
  * should be displayed.
  */
-const struct screen_info *get_active_screen(void)
+static int screen_find_active(void)
 {
         int ret = 0;
         bool force_follow_mouse = false;
@@ -414,7 +474,14 @@ sc_cleanup:
         x_follow_tear_down_error_handler();
         assert(screens);
         assert(ret >= 0 && ret < screens_len);
-        return &screens[ret];
+        return ret;
+}
+
+const struct screen_info *get_active_screen(void)
+{
+        if (active_screen < 0)
+                active_screen = screen_find_active();
+        return &screens[active_screen];
 }
 
 /*
@@ -20,7 +20,17 @@ void init_screens(void);
 void screen_dpi_xft_cache_purge(void);
 bool screen_check_event(XEvent *ev);
 
+/**
+ * Get the screen to show the notifications on. It is looked up only once
+ * and then kept until screen_forget_active() gets called.
+ */
 const struct screen_info *get_active_screen(void);
+
+/**
+ * Look up the active screen again on the next get_active_screen(), as the
+ * focus, the mouse or the settings may have moved
+ */
+void screen_forget_active(void);
 double screen_dpi_get(const struct screen_info *scr);
 
 /**
@@ -35,6 +45,13 @@ double screen_dpi_get(const struct screen_info *scr);
  */
 bool have_fullscreen_window(void);
 
+/**
+ * Check if a PropertyNotify event may change the active screen or whether
+ * the focused window is in fullscreen mode. The focused window gets
+ * watched by have_fullscreen_window(), but only its state is of interest.
+ */
+bool screen_is_state_change(const XPropertyEvent *ev);
+
 /**
  * Check if window is in fullscreen mode
  *
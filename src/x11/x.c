@@ -18,9 +18,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <unistd.h>
 
 #include <X11/extensions/shape.h>
+#include <X11/extensions/XShm.h>
 #include <X11/Xatom.h>
 #include <X11/X.h>
 #include <X11/XKBlib.h>
@@ -51,13 +54,35 @@
 #define WIDTH 400
 #define HEIGHT 400
 
+/**
+ * An image in shared memory, which frames get rendered into and copied from
+ * to the window by the server, without sending the pixels over the connection
+ */
+struct x_shm {
+        XShmSegmentInfo info;
+        size_t capacity;
+        XImage *image;
+        cairo_surface_t *srf;
+        GC gc;
+        bool busy;   /**< The server may still read the last frame */
+};
+
+/** The number of images frames get rendered into in turn */
+#define X_SHM_IMAGES 2
+
 struct window_x11 {
         Window xwin;
+        Visual *visual;
+        int depth;
+        /** A frame can be rendered into one, while the server still reads the other */
+        struct x_shm shm[X_SHM_IMAGES];
+        bool shm_failed; /**< Shared memory is unavailable, e.g. with a remote server */
         cairo_surface_t *root_surface;
         cairo_t *c_ctx;
         GSource *esrc;
         int cur_screen;
         bool visible;
+        bool exposed; /**< The window contents got lost and have to be painted completely */
         struct dimensions dim;
 };
 
@@ -69,7 +94,12 @@ struct x11_source {
 struct x_context xctx;
 bool dunst_grab_errored = false;
 
-static bool fullscreen_last = false;
+/** Before this time the user can't be idle, see x_is_idle() */
+static gint64 idle_check_at = 0;
+
+/** The type of the event sent when the server is done with an image, -1 without MIT-SHM */
+static int shm_completion = -1;
+static bool shm_errored = false;
 
 static void XRM_update_db(void);
 
@@ -180,14 +210,53 @@ void x_display_surface(cairo_surface_t *srf, window winptr, const struct dimensi
 
         calc_window_pos(scr, round(dim->w * scale), round(dim->h * scale), &x, &y);
 
+        bool partial = dim->damage && win->visible && !win->exposed
+                && win->dim.w == round(dim->w * scale) && win->dim.h == round(dim->h * scale);
+        win->exposed = false;
+
         x_win_move(win, x, y, round(dim->w * scale), round(dim->h * scale));
         cairo_xlib_surface_set_size(win->root_surface, round(dim->w * scale), round(dim->h * scale));
 
-        XClearWindow(xctx.dpy, win->xwin);
+        struct x_shm *shm = NULL;
+        for (int i = 0; i < X_SHM_IMAGES; i++)
+                if (srf == win->shm[i].srf)
+                        shm = &win->shm[i];
+
+        if (shm) {
+                cairo_surface_flush(srf);
+                int n = partial ? cairo_region_num_rectangles(dim->damage) : 1;
+                for (int i = 0; i < n; i++) {
+                        cairo_rectangle_int_t rect = { 0, 0, shm->image->width, shm->image->height };
+                        if (partial)
+                                cairo_region_get_rectangle(dim->damage, i, &rect);
+                        // Requests are handled in order, so the last completion covers all
+                        XShmPutImage(xctx.dpy, win->xwin, shm->gc, shm->image,
+                                     rect.x, rect.y, rect.x, rect.y, rect.width, rect.height,
+                                     i == n - 1);
+                }
+                shm->busy = n > 0;
+        } else if (partial) {
+                // Copy only the changed rectangles, the rest of the window still shows them
+                int n = cairo_region_num_rectangles(dim->damage);
+                for (int i = 0; i < n; i++) {
+                        cairo_rectangle_int_t rect;
+                        cairo_region_get_rectangle(dim->damage, i, &rect);
+                        cairo_rectangle(win->c_ctx, rect.x, rect.y, rect.width, rect.height);
+                }
+                cairo_save(win->c_ctx);
+                cairo_clip(win->c_ctx);
+                cairo_set_operator(win->c_ctx, CAIRO_OPERATOR_SOURCE);
+                cairo_set_source_surface(win->c_ctx, srf, 0, 0);
+                cairo_paint(win->c_ctx);
+                cairo_restore(win->c_ctx);
+                cairo_show_page(win->c_ctx);
+        } else {
+                XClearWindow(xctx.dpy, win->xwin);
 
-        cairo_set_source_surface(win->c_ctx, srf, 0, 0);
-        cairo_paint(win->c_ctx);
-        cairo_show_page(win->c_ctx);
+                cairo_set_source_surface(win->c_ctx, srf, 0, 0);
+                cairo_paint(win->c_ctx);
+                cairo_show_page(win->c_ctx);
+        }
 
         if (settings.corner_radius != 0 && ! x_win_composited(win))
                 x_win_corners_shape(win, round(dim->corner_radius * scale));
@@ -196,6 +265,183 @@ void x_display_surface(cairo_surface_t *srf, window winptr, const struct dimensi
 
         XFlush(xctx.dpy);
 
+        // The mouse may move anywhere until the next frame
+        if (settings.f_mode == FOLLOW_MOUSE)
+                screen_forget_active();
+}
+
+static int XShmErrorHandler(Display *display, XErrorEvent *e)
+{
+        shm_errored = true;
+        return 0;
+}
+
+static void x_shm_free_image(struct x_shm *shm)
+{
+        if (shm->srf)
+                cairo_surface_destroy(shm->srf);
+        if (shm->image)
+                XDestroyImage(shm->image);
+        shm->srf = NULL;
+        shm->image = NULL;
+}
+
+static void x_shm_free(struct x_shm *shm)
+{
+        x_shm_free_image(shm);
+
+        if (shm->capacity) {
+                XShmDetach(xctx.dpy, &shm->info);
+                shmdt(shm->info.shmaddr);
+                shm->capacity = 0;
+        }
+
+        if (shm->gc)
+                XFreeGC(xctx.dpy, shm->gc);
+        shm->gc = NULL;
+}
+
+/**
+ * Attach a new segment of the given size to the server
+ */
+static bool x_shm_attach(struct x_shm *shm, size_t size)
+{
+        shm->info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        if (shm->info.shmid < 0)
+                return false;
+
+        shm->info.shmaddr = shmat(shm->info.shmid, NULL, 0);
+        shm->info.readOnly = false;
+        // The segment gets removed once both sides detached
+        shmctl(shm->info.shmid, IPC_RMID, NULL);
+        if (shm->info.shmaddr == (char *) -1)
+                return false;
+
+        // Attaching fails asynchronously if the server can't access the segment
+        shm_errored = false;
+        XErrorHandler handler = XSetErrorHandler(XShmErrorHandler);
+        XShmAttach(xctx.dpy, &shm->info);
+        XSync(xctx.dpy, false);
+        XSetErrorHandler(handler);
+
+        if (shm_errored) {
+                shmdt(shm->info.shmaddr);
+                return false;
+        }
+
+        shm->capacity = size;
+        return true;
+}
+
+static bool x_shm_create_image(struct window_x11 *win, struct x_shm *shm, int width, int height)
+{
+        x_shm_free_image(shm);
+
+        shm->image = XShmCreateImage(xctx.dpy, win->visual, win->depth, ZPixmap, NULL,
+                                     &shm->info, width, height);
+        if (!shm->image)
+                return false;
+
+        // cairo renders native endian 32 bit pixels
+        int byte_order = G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst;
+        if (shm->image->bits_per_pixel != 32 || shm->image->byte_order != byte_order
+            || shm->image->red_mask != 0xff0000) {
+                LOG_I("X11: Image format does not fit cairo, not using MIT-SHM");
+                return false;
+        }
+
+        size_t size = (size_t) shm->image->bytes_per_line * height;
+        if (size > shm->capacity) {
+                size_t capacity = 4096;
+                while (capacity < size)
+                        capacity *= 2;
+
+                if (shm->capacity) {
+                        XShmDetach(xctx.dpy, &shm->info);
+                        shmdt(shm->info.shmaddr);
+                        shm->capacity = 0;
+                }
+                if (!x_shm_attach(shm, capacity)) {
+                        LOG_I("X11: Could not attach shared memory, not using MIT-SHM");
+                        return false;
+                }
+        }
+
+        if (!shm->gc)
+                shm->gc = XCreateGC(xctx.dpy, win->xwin, 0, NULL);
+
+        shm->image->data = shm->info.shmaddr;
+        shm->srf = cairo_image_surface_create_for_data((unsigned char *) shm->image->data,
+                                                       CAIRO_FORMAT_ARGB32, width, height,
+                                                       shm->image->bytes_per_line);
+        return true;
+}
+
+/**
+ * Mark the image a ShmCompletion event is about as free to render into
+ */
+static void x_shm_completed(struct window_x11 *win, const XEvent *ev)
+{
+        const XShmCompletionEvent *done = (const XShmCompletionEvent *) ev;
+        for (int i = 0; i < X_SHM_IMAGES; i++)
+                if (win->shm[i].capacity && win->shm[i].info.shmseg == done->shmseg)
+                        win->shm[i].busy = false;
+}
+
+/**
+ * @return an image the server is done with, preferably one of the given size
+ * @retval NULL if the server may still read all of them
+ */
+static struct x_shm *x_shm_find_free(struct window_x11 *win, int width, int height)
+{
+        struct x_shm *found = NULL;
+        for (int i = 0; i < X_SHM_IMAGES; i++) {
+                struct x_shm *shm = &win->shm[i];
+                if (shm->busy)
+                        continue;
+                if (shm->image && shm->image->width == width && shm->image->height == height)
+                        return shm;
+                if (!found)
+                        found = shm;
+        }
+        return found;
+}
+
+cairo_surface_t* x_win_get_buffer(window winptr, int width, int height)
+{
+        struct window_x11 *win = (struct window_x11*)winptr;
+
+        if (win->shm_failed || width <= 0 || height <= 0)
+                return NULL;
+
+        // Take the completions the server sent already, without waiting
+        XEvent ev;
+        while (XCheckTypedEvent(xctx.dpy, shm_completion, &ev))
+                x_shm_completed(win, &ev);
+
+        struct x_shm *shm = x_shm_find_free(win, width, height);
+        if (!shm) {
+                // Only wait for the server as a last resort, once it handled
+                // all requests, it is done with all images
+                XSync(xctx.dpy, false);
+                while (XCheckTypedEvent(xctx.dpy, shm_completion, &ev))
+                        x_shm_completed(win, &ev);
+                for (int i = 0; i < X_SHM_IMAGES; i++)
+                        win->shm[i].busy = false;
+                shm = x_shm_find_free(win, width, height);
+        }
+
+        if (!shm->image || shm->image->width != width || shm->image->height != height) {
+                if (!x_shm_create_image(win, shm, width, height)) {
+                        // Fall back to painting through Xlib
+                        for (int i = 0; i < X_SHM_IMAGES; i++)
+                                x_shm_free(&win->shm[i]);
+                        win->shm_failed = true;
+                        return NULL;
+                }
+        }
+
+        return shm->srf;
 }
 
 cairo_t* x_win_get_context(window winptr)
@@ -308,6 +554,7 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                 case Expose:
                         LOG_D("XEvent: processing 'Expose'");
                         if (ev.xexpose.count == 0 && win->visible) {
+                                win->exposed = true;
                                 draw();
                         }
                         break;
@@ -372,6 +619,8 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                                 }
                                 break;
                         }
+                        if (!screen_is_state_change(&ev.xproperty))
+                                break;
                         /* Explicitly fallthrough. Other PropertyNotify events, e.g. catching
                          * _NET_WM get handled in the Focus(In|Out) section */
                         /* fall through */
@@ -379,11 +628,12 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                 case FocusIn:
                 case FocusOut:
                         LOG_D("XEvent: Checking for active screen changes");
+                        screen_forget_active();
                         fullscreen_now = have_fullscreen_window();
                         scr = get_active_screen();
 
-                        if (fullscreen_now != fullscreen_last) {
-                                fullscreen_last = fullscreen_now;
+                        if (fullscreen_now != dunst_status_get().fullscreen) {
+                                dunst_status(S_FULLSCREEN, fullscreen_now);
                                 wake_up();
                         } else if (   settings.f_mode != FOLLOW_NONE
                         /* Ignore PropertyNotify, when we're still on the
@@ -397,6 +647,10 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                         }
                         break;
                 default:
+                        if (ev.type == shm_completion) {
+                                x_shm_completed(win, &ev);
+                                break;
+                        }
                         if (!screen_check_event(&ev)) {
                                 LOG_D("XEvent: Ignoring '%d'", ev.type);
                         }
@@ -409,15 +663,27 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
 
 /*
  * Check whether the user is currently idle.
+ *
+ * The idle time only grows until the next input, so the screensaver
+ * extension isn't asked again before the user could have become idle.
  */
 bool x_is_idle(void)
 {
-        XScreenSaverQueryInfo(xctx.dpy, DefaultRootWindow(xctx.dpy),
-                              xctx.screensaver_info);
         if (settings.idle_threshold == 0) {
                 return false;
         }
-        return xctx.screensaver_info->idle > settings.idle_threshold / 1000;
+
+        gint64 now = time_monotonic_now();
+        if (now < idle_check_at)
+                return false;
+
+        XScreenSaverQueryInfo(xctx.dpy, DefaultRootWindow(xctx.dpy),
+                              xctx.screensaver_info);
+        if (xctx.screensaver_info->idle > settings.idle_threshold / 1000)
+                return true;
+
+        idle_check_at = now + settings.idle_threshold - (gint64) xctx.screensaver_info->idle * 1000;
+        return false;
 }
 
 /*
@@ -552,6 +818,7 @@ bool x_setup(void)
         x_shortcut_ungrab(&settings.context_ks);
 
         xctx.screensaver_info = XScreenSaverAllocInfo();
+        idle_check_at = 0;
 
         XrmInitialize();
         XRM_update_db();
@@ -662,6 +929,16 @@ window x_win_create(void)
                 depth = DefaultDepth(xctx.dpy, scr_n);
         }
 
+        win->visual = vis;
+        win->depth = depth;
+
+        if (XShmQueryExtension(xctx.dpy)) {
+                shm_completion = XShmGetEventBase(xctx.dpy) + ShmCompletion;
+        } else {
+                LOG_I("X11: MIT-SHM is not available");
+                win->shm_failed = true;
+        }
+
         wa.override_redirect = true;
         wa.background_pixmap = None;
         wa.background_pixel = 0;
@@ -723,6 +1000,8 @@ void x_win_destroy(window winptr)
         g_source_destroy(win->esrc);
         g_source_unref(win->esrc);
 
+        for (int i = 0; i < X_SHM_IMAGES; i++)
+                x_shm_free(&win->shm[i]);
         cairo_destroy(win->c_ctx);
         cairo_surface_destroy(win->root_surface);
         XDestroyWindow(xctx.dpy, win->xwin);
@@ -38,6 +38,7 @@ void x_win_hide(window);
 
 void x_display_surface(cairo_surface_t *srf, window, const struct dimensions *dim);
 
+cairo_surface_t* x_win_get_buffer(window win, int width, int height);
 cairo_t* x_win_get_context(window);
 
 /* X misc */
@@ -787,6 +787,123 @@ TEST test_dbus_cb_dunst_NotificationListHistory(void)
         PASS();
 }
 
+TEST test_dbus_cb_dunst_NotificationQueryHistory(void)
+{
+        const char *appnames[] = { "first", "second", "first", "first" };
+        for (size_t i = 0; i < G_N_ELEMENTS(appnames); i++) {
+                struct notification *n = notification_create();
+                n->appname = g_strdup(appnames[i]);
+                n->summary = g_strdup_printf("n%zu", i);
+                n->urgency = URG_NORM;
+                queues_history_push(n);
+        }
+
+        GVariantBuilder query;
+        g_variant_builder_init(&query, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&query, "{sv}", "appname", g_variant_new_string("first"));
+        g_variant_builder_add(&query, "{sv}", "urgency", g_variant_new_string("normal"));
+        g_variant_builder_add(&query, "{sv}", "offset", g_variant_new_uint32(1));
+        g_variant_builder_add(&query, "{sv}", "limit", g_variant_new_uint32(1));
+        const char *fields[] = { "summary", "id", NULL };
+        g_variant_builder_add(&query, "{sv}", "fields", g_variant_new_strv(fields, -1));
+
+        GVariant *result = dbus_invoke_ifac("NotificationQueryHistory",
+                                            g_variant_new("(a{sv})", &query), DUNST_IFAC);
+        ASSERT(result != NULL);
+        ASSERT_STR_EQ("(aa{sv})", g_variant_get_type_string(result));
+
+        GVariant *array = g_variant_get_child_value(result, 0);
+        ASSERT_EQ(1, g_variant_n_children(array));
+
+        GVariant *dict = g_variant_get_child_value(array, 0);
+        ASSERT_EQ(2, g_variant_n_children(dict));
+
+        GVariantDict d;
+        g_variant_dict_init(&d, dict);
+
+        char *str;
+        ASSERT(g_variant_dict_lookup(&d, "summary", "s", &str));
+        ASSERT_STR_EQ("n2", str);
+        g_free(str);
+        ASSERT(!g_variant_dict_contains(&d, "appname"));
+
+        g_variant_dict_clear(&d);
+        g_variant_unref(dict);
+        g_variant_unref(array);
+        g_variant_unref(result);
+
+        g_variant_builder_init(&query, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&query, "{sv}", "urgency", g_variant_new_string("critical"));
+        result = dbus_invoke_ifac("NotificationQueryHistory",
+                                  g_variant_new("(a{sv})", &query), DUNST_IFAC);
+        ASSERT(result != NULL);
+        array = g_variant_get_child_value(result, 0);
+        ASSERT_EQ(0, g_variant_n_children(array));
+        g_variant_unref(array);
+        g_variant_unref(result);
+
+        // Options of the wrong type get rejected instead of ignored
+        g_variant_builder_init(&query, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&query, "{sv}", "limit", g_variant_new_int32(1));
+        result = dbus_invoke_ifac("NotificationQueryHistory",
+                                  g_variant_new("(a{sv})", &query), DUNST_IFAC);
+        ASSERT(result == NULL);
+
+        g_variant_builder_init(&query, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&query, "{sv}", "since", g_variant_new_uint64(0));
+        result = dbus_invoke_ifac("NotificationQueryHistory",
+                                  g_variant_new("(a{sv})", &query), DUNST_IFAC);
+        ASSERT(result == NULL);
+
+        queues_history_clear();
+        PASS();
+}
+
+TEST test_dbus_cb_dunst_NotificationQueryHistory_since(void)
+{
+        gint64 now = time_monotonic_now();
+        // closed long ago, arrived recently and arrived early but closed recently
+        const char *summaries[] = { "old", "new", "late" };
+        const gint64 timestamps[] = { now - S2US(20), now - S2US(5), now - S2US(30) };
+        for (size_t i = 0; i < G_N_ELEMENTS(summaries); i++) {
+                struct notification *n = notification_create();
+                n->summary = g_strdup(summaries[i]);
+                n->timestamp = timestamps[i];
+                queues_history_push(n);
+                if (i == 0)
+                        n->history_time = now - S2US(15);
+        }
+
+        GVariantBuilder query;
+        g_variant_builder_init(&query, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&query, "{sv}", "since", g_variant_new_int64(now - S2US(10)));
+        const char *fields[] = { "summary", NULL };
+        g_variant_builder_add(&query, "{sv}", "fields", g_variant_new_strv(fields, -1));
+
+        GVariant *result = dbus_invoke_ifac("NotificationQueryHistory",
+                                            g_variant_new("(a{sv})", &query), DUNST_IFAC);
+        ASSERT(result != NULL);
+
+        GVariant *array = g_variant_get_child_value(result, 0);
+        ASSERT_EQ(1, g_variant_n_children(array));
+
+        GVariant *dict = g_variant_get_child_value(array, 0);
+        GVariantDict d;
+        g_variant_dict_init(&d, dict);
+
+        char *str;
+        ASSERT(g_variant_dict_lookup(&d, "summary", "s", &str));
+        ASSERT_STR_EQ("new", str);
+        g_free(str);
+
+        g_variant_dict_clear(&d);
+        g_variant_unref(dict);
+        g_variant_unref(array);
+        g_variant_unref(result);
+        queues_history_clear();
+        PASS();
+}
+
 TEST test_dbus_cb_dunst_RuleEnable(void)
 {
         struct rule *rule = rule_new("test_rule_enable");
@@ -1737,6 +1854,8 @@ gpointer run_threaded_tests(gpointer data)
         RUN_TEST(test_clearhistory_and_signal);
         RUN_TEST(test_removehistory_and_signal);
         RUN_TEST(test_dbus_cb_dunst_NotificationListHistory);
+        RUN_TEST(test_dbus_cb_dunst_NotificationQueryHistory);
+        RUN_TEST(test_dbus_cb_dunst_NotificationQueryHistory_since);
         RUN_TEST(test_dbus_cb_dunst_RuleEnable);
         RUN_TEST(test_dbus_cb_dunst_RuleList);
 
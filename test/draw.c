@@ -30,6 +30,7 @@ const struct output dummy_output = {
         wl_win_hide,
 
         wl_display_surface,
+        wl_win_get_buffer,
         wl_win_get_context,
 
         noop_screen,
@@ -47,6 +48,7 @@ const struct output dummy_output = {
         x_win_hide,
 
         x_display_surface,
+        x_win_get_buffer,
         x_win_get_context,
 
         noop_screen,
@@ -153,6 +155,104 @@ TEST test_layout_from_notification_no_icon(void)
         PASS();
 }
 
+TEST test_layout_from_notification_cached(void)
+{
+        struct notification *n = test_notification("test", 10);
+        n->text_to_render = g_strdup("<b>cached</b>");
+
+        struct colored_layout *cl = layout_from_notification(c, n);
+        struct colored_layout *cl2 = layout_from_notification(c, n);
+        ASSERT(n->layout_cache);
+        ASSERT_EQ(cl->l, cl2->l);
+        ASSERT_EQ(cl->measure, cl2->measure);
+        ASSERT(cl->l != cl->measure);
+        ASSERT_FALSE(cl->age);
+        free_colored_layout(cl2);
+
+        // The age is laid out apart from the text
+        n->age_to_render = g_strdup(" (1s old)");
+        cl2 = layout_from_notification(c, n);
+        ASSERT_EQ(cl->l, cl2->l);
+        ASSERT(cl2->age);
+        ASSERT_STR_EQ(" (1s old)", pango_layout_get_text(cl2->age));
+
+        // It follows the text on the same line, when it fits there
+        int w, h, w_age, h_age;
+        layout_setup(cl2, cl2->measure, 1000, 1000, 1);
+        get_layout_text_size(cl, cl->measure, &w, &h, 1);
+        get_layout_text_size(cl2, cl2->measure, &w_age, &h_age, 1);
+        ASSERT_EQ(h, h_age);
+        ASSERT(w_age > w);
+        free_colored_layout(cl2);
+
+        g_free(n->text_to_render);
+        n->text_to_render = g_strdup("changed");
+        cl2 = layout_from_notification(c, n);
+        ASSERT(cl->l != cl2->l);
+        ASSERT_STR_EQ("changed", pango_layout_get_text(cl2->l));
+
+        free_colored_layout(cl);
+        free_colored_layout(cl2);
+        notification_unref(n);
+        PASS();
+}
+
+TEST test_layout_hash(void)
+{
+        struct notification *n = test_notification("test", 10);
+        n->text_to_render = g_strdup("hash");
+        n->progress = 10;
+
+        struct colored_layout *cl = layout_from_notification(c, n);
+        guint hash = layout_hash(cl, NULL, C_NONE);
+        ASSERT_EQ(hash, layout_hash(cl, NULL, C_NONE));
+        ASSERT(hash != layout_hash(cl, NULL, C_TOP));
+
+        // Only notifications with a changed progress bar get repainted
+        n->progress = 20;
+        ASSERT(hash != layout_hash(cl, NULL, C_NONE));
+        free_colored_layout(cl);
+
+        n->progress = 10;
+        n->age_to_render = g_strdup(" (1s old)");
+        cl = layout_from_notification(c, n);
+        ASSERT(hash != layout_hash(cl, NULL, C_NONE));
+
+        free_colored_layout(cl);
+        notification_unref(n);
+        PASS();
+}
+
+TEST test_frame_get(void)
+{
+        cairo_surface_t *buffers[DRAW_FRAMES + 1];
+        for (int i = 0; i < DRAW_FRAMES + 1; i++)
+                buffers[i] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 10, 10);
+
+        struct dimensions dim = { .w = 10, .h = 10 };
+        struct draw_frame *f = frame_get(buffers[0]);
+        ASSERT_FALSE(frame_prepare(f, &dim, 1, 0));
+        ASSERT_EQ(f, frame_get(buffers[0]));
+        ASSERT(frame_prepare(f, &dim, 1, 0));
+
+        // A buffer holds the frame rendered into it, until it is used least recently
+        for (int i = 1; i < DRAW_FRAMES; i++)
+                ASSERT_FALSE(frame_prepare(frame_get(buffers[i]), &dim, 1, 0));
+        ASSERT(frame_prepare(frame_get(buffers[0]), &dim, 1, 0));
+        ASSERT_FALSE(frame_prepare(frame_get(buffers[DRAW_FRAMES]), &dim, 1, 0));
+        ASSERT_FALSE(frame_prepare(frame_get(buffers[1]), &dim, 1, 0));
+
+        // Fractional scales are always painted completely
+        ASSERT_FALSE(frame_prepare(f, &dim, 1.5, 0));
+        ASSERT_FALSE(frame_prepare(f, &dim, 1.5, 0));
+
+        for (int i = 0; i < DRAW_FRAMES; i++)
+                frame_reset(&frames.frames[i]);
+        for (int i = 0; i < DRAW_FRAMES + 1; i++)
+                cairo_surface_destroy(buffers[i]);
+        PASS();
+}
+
 TEST test_calculate_dimensions_height_no_gaps(void)
 {
         struct length original_height = settings.height;
@@ -386,6 +486,9 @@ SUITE(suite_draw)
                         RUN_TEST(test_layout_from_notification);
                         RUN_TEST(test_layout_from_notification_icon_off);
                         RUN_TEST(test_layout_from_notification_no_icon);
+                        RUN_TEST(test_layout_from_notification_cached);
+                        RUN_TEST(test_layout_hash);
+                        RUN_TEST(test_frame_get);
                         RUN_TEST(test_calculate_dimensions_height_no_gaps);
                         RUN_TEST(test_calculate_dimensions_height_gaps);
                         RUN_TEST(test_calculate_dimensions_height_min);
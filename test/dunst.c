@@ -15,7 +15,23 @@ TEST test_dunst_status(void)
         PASS();
 }
 
+TEST test_dunst_status_invalidate(void)
+{
+        dunst_status(S_FULLSCREEN, false);
+        ASSERT_FALSE(fullscreen_stale);
+
+        dunst_status_invalidate(S_FULLSCREEN);
+        ASSERT(fullscreen_stale);
+        ASSERT_FALSE(status.fullscreen);
+
+        dunst_status(S_FULLSCREEN, true);
+        ASSERT_FALSE(fullscreen_stale);
+
+        PASS();
+}
+
 SUITE(suite_dunst)
 {
         RUN_TEST(test_dunst_status);
+        RUN_TEST(test_dunst_status_invalidate);
 }
@@ -0,0 +1,160 @@
+#include "../src/history_log.c"
+#include "greatest.h"
+
+#include <glib/gstdio.h>
+
+#include "helpers.h"
+
+static char *history_log_test_path(void)
+{
+        char *dir = g_dir_make_tmp("dunst-history-XXXXXX", NULL);
+        char *path = g_build_filename(dir, "state", "history.log", NULL);
+        g_free(dir);
+        return path;
+}
+
+static void history_log_test_cleanup(const char *path)
+{
+        char *state = g_path_get_dirname(path);
+        char *dir = g_path_get_dirname(state);
+        g_remove(path);
+        g_rmdir(state);
+        g_rmdir(dir);
+        g_free(state);
+        g_free(dir);
+}
+
+TEST test_history_log_default_path(void)
+{
+        char *old = g_strdup(g_getenv("XDG_STATE_HOME"));
+
+        g_setenv("XDG_STATE_HOME", "/state", TRUE);
+        char *path = history_log_default_path();
+        ASSERT_STR_EQ("/state/dunst/history.log", path);
+        g_free(path);
+
+        // Relative paths are invalid per the basedir spec
+        g_setenv("XDG_STATE_HOME", "state", TRUE);
+        path = history_log_default_path();
+        char *expected = g_build_filename(g_get_home_dir(), ".local", "state", "dunst", "history.log", NULL);
+        ASSERT_STR_EQ(expected, path);
+        g_free(expected);
+        g_free(path);
+
+        if (old)
+                g_setenv("XDG_STATE_HOME", old, TRUE);
+        else
+                g_unsetenv("XDG_STATE_HOME");
+        g_free(old);
+        PASS();
+}
+
+TEST test_history_log_closed(void)
+{
+        struct notification *n = test_notification("closed", 0);
+
+        ASSERT_FALSE(history_log_is_open());
+        history_log_append(n);
+        history_log_remove(n->id);
+        history_log_clear();
+        ASSERT_EQ(NULL, history_log_load(0));
+        ASSERT_EQ(0, history_log_records());
+
+        notification_unref(n);
+        PASS();
+}
+
+TEST test_history_log_roundtrip(void)
+{
+        char *path = history_log_test_path();
+        ASSERT(history_log_open(path));
+
+        // A new log has nothing to load
+        ASSERT_EQ(NULL, history_log_load(0));
+
+        const char *names[] = { "n0", "n1", "n2", "n3" };
+        for (size_t i = 0; i < G_N_ELEMENTS(names); i++) {
+                struct notification *n = test_notification(names[i], 0);
+                n->id = i + 1;
+                n->urgency = URG_CRIT;
+                history_log_append(n);
+                notification_unref(n);
+        }
+        history_log_remove(2);
+        ASSERT_EQ(5, history_log_records());
+
+        history_log_close();
+        ASSERT(history_log_open(path));
+
+        // Only the newest entries are kept
+        GList *restored = history_log_load(2);
+        ASSERT_EQ(2, g_list_length(restored));
+
+        struct notification *n = restored->data;
+        ASSERT_STR_EQ("n2", n->summary);
+        ASSERT_STR_EQ("app of n2", n->appname);
+        ASSERT_EQ(3, n->id);
+        ASSERT_EQ(URG_CRIT, n->urgency);
+
+        n = restored->next->data;
+        ASSERT_STR_EQ("n3", n->summary);
+        ASSERT_EQ(4, n->id);
+        ASSERT_EQ(5, history_log_records());
+
+        // The mapping is gone after loading
+        ASSERT_EQ(NULL, history_log_load(0));
+
+        history_log_rewrite(restored);
+        ASSERT_EQ(2, history_log_records());
+        g_list_free_full(restored, (GDestroyNotify) notification_unref);
+
+        history_log_clear();
+        history_log_close();
+        ASSERT(history_log_open(path));
+        ASSERT_EQ(NULL, history_log_load(0));
+
+        history_log_close();
+        history_log_test_cleanup(path);
+        g_free(path);
+        PASS();
+}
+
+TEST test_history_log_truncated(void)
+{
+        char *path = history_log_test_path();
+        ASSERT(history_log_open(path));
+
+        struct notification *n = test_notification("complete", 0);
+        history_log_append(n);
+        notification_unref(n);
+        n = test_notification("torn", 0);
+        history_log_append(n);
+        notification_unref(n);
+        history_log_close();
+
+        // Cut the last record in half, as if dunst got killed while writing
+        gchar *contents;
+        gsize len;
+        ASSERT(g_file_get_contents(path, &contents, &len, NULL));
+        ASSERT(g_file_set_contents(path, contents, len - 10, NULL));
+        g_free(contents);
+
+        ASSERT(history_log_open(path));
+        GList *restored = history_log_load(0);
+        ASSERT_EQ(1, g_list_length(restored));
+        ASSERT_STR_EQ("complete", ((struct notification *) restored->data)->summary);
+        g_list_free_full(restored, (GDestroyNotify) notification_unref);
+
+        history_log_close();
+        history_log_test_cleanup(path);
+        g_free(path);
+        PASS();
+}
+
+SUITE(suite_history_log)
+{
+        RUN_TEST(test_history_log_default_path);
+        RUN_TEST(test_history_log_closed);
+        RUN_TEST(test_history_log_roundtrip);
+        RUN_TEST(test_history_log_truncated);
+}
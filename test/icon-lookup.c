@@ -46,6 +46,57 @@ TEST test_find_icon(void)
         PASS();
 }
 
+TEST test_find_icon_after_theme_change(void)
+{
+        char *location = g_dir_make_tmp("dunst-theme-XXXXXX", NULL);
+        char *apps = g_build_filename(location, "theme", "16x16", "apps", NULL);
+        char *index_theme = g_build_filename(location, "theme", "index.theme", NULL);
+        char *icon_file = g_build_filename(apps, "added.png", NULL);
+        const char *contents =
+                "[Icon Theme]\n"
+                "Name=Changing\n"
+                "Directories=16x16/apps\n"
+                "\n"
+                "[16x16/apps]\n"
+                "Size=16\n"
+                "Type=Fixed\n";
+
+        ASSERT_EQ(0, g_mkdir_with_parents(apps, 0700));
+        ASSERT(g_file_set_contents(index_theme, contents, -1, NULL));
+
+        int theme_index = load_icon_theme_from_dir(location, "theme");
+        ASSERT(theme_index >= 0);
+        ASSERT_EQ(NULL, find_icon_in_theme("added", theme_index, 16));
+
+        ASSERT(g_file_set_contents(icon_file, "", 0, NULL));
+
+        // Skip waiting for the next check and for the mtime to tick over
+        icon_themes[theme_index].index_checked = 0;
+        icon_themes[theme_index].dirs[0].mtime = 0;
+
+        char *icon = find_icon_in_theme("added", theme_index, 16);
+        ASSERT_STR_EQ(icon_file, icon);
+        g_free(icon);
+        ASSERT_EQ(NULL, find_icon_in_theme("added", theme_index, 32));
+
+        free_all_themes();
+        g_remove(icon_file);
+        g_remove(index_theme);
+        g_rmdir(apps);
+        char *dir = g_path_get_dirname(apps);
+        g_rmdir(dir);
+        g_free(dir);
+        dir = g_build_filename(location, "theme", NULL);
+        g_rmdir(dir);
+        g_free(dir);
+        g_rmdir(location);
+        g_free(icon_file);
+        g_free(index_theme);
+        g_free(apps);
+        g_free(location);
+        PASS();
+}
+
 TEST test_new_icon_overrides_raw_icon(void) {
         setup_test_theme();
 
@@ -145,6 +196,7 @@ SUITE (suite_icon_lookup)
 {
         RUN_TEST(test_load_theme_from_dir);
         RUN_TEST(test_find_icon);
+        RUN_TEST(test_find_icon_after_theme_change);
         RUN_TEST(test_new_icon_overrides_raw_icon);
         bool bench = false;
         if (bench) {
@@ -60,6 +60,63 @@ TEST test_icon_size_clamp_not_necessary(int min_icon_size, int max_icon_size)
         PASS();
 }
 
+TEST test_icon_cache_peek_uncounted(void)
+{
+        int budget = settings.icon_cache_size;
+        char *path = g_build_filename(base, DATAPREFIX, "icons", "valid.png", NULL);
+        char *id = NULL;
+        struct icon_cache_stats before, after;
+
+        settings.icon_cache_size = 1024;
+        icon_cache_clear();
+        icon_cache_get_stats(&before);
+
+        // Lookups without a callback only take what is cached already
+        ASSERT_EQ(NULL, icon_surface_from_file_async(path, &id, 0, 0, 1, NULL, NULL));
+        cairo_surface_t *s1 = icon_surface_from_file(path, &id, 0, 0, 1);
+        g_clear_pointer(&id, g_free);
+        cairo_surface_t *s2 = icon_surface_from_file_async(path, &id, 0, 0, 1, NULL, NULL);
+        ASSERT(s1);
+        ASSERT_EQ(s1, s2);
+
+        icon_cache_get_stats(&after);
+        ASSERT_EQ(before.misses + 1, after.misses);
+        ASSERT_EQ(before.hits, after.hits);
+
+        cairo_surface_destroy(s1);
+        cairo_surface_destroy(s2);
+        icon_cache_clear();
+        settings.icon_cache_size = budget;
+        g_free(id);
+        g_free(path);
+        PASS();
+}
+
+TEST test_get_pixbuf_from_file_truncated(void)
+{
+        char *path = g_build_filename(base, DATAPREFIX, "icons", "valid.png", NULL);
+        char *dir = g_dir_make_tmp("dunst-icons-XXXXXX", NULL);
+        char *file = g_build_filename(dir, "truncated.png", NULL);
+        char *data;
+        gsize len;
+
+        // Keep the header, so only decoding the pixels fails
+        ASSERT(g_file_get_contents(path, &data, &len, NULL));
+        ASSERT(g_file_set_contents(file, data, MIN(len, 64), NULL));
+
+        char *id = NULL;
+        ASSERT_EQ(NULL, get_pixbuf_from_file(file, &id, 0, 0, 1));
+        ASSERT_EQ(NULL, id);
+
+        g_remove(file);
+        g_rmdir(dir);
+        g_free(data);
+        g_free(file);
+        g_free(dir);
+        g_free(path);
+        PASS();
+}
+
 TEST test_icon_size_clamp_too_big(int min_icon_size, int max_icon_size)
 {
         int w = 75, h = 150;
@@ -82,6 +139,274 @@ TEST test_icon_size_clamp_too_small_then_too_big(int min_icon_size, int max_icon
         PASS();
 }
 
+TEST test_get_path_from_icon_name_cached(void)
+{
+        char *old_icon_path = settings.icon_path;
+        bool old_recursive = settings.enable_recursive_icon_lookup;
+        char *dir = g_dir_make_tmp("dunst-icons-XXXXXX", NULL);
+        char *file = g_build_filename(dir, "late.png", NULL);
+
+        settings.icon_path = dir;
+        settings.enable_recursive_icon_lookup = false;
+        icon_path_cache_clear();
+
+        ASSERT_EQ(NULL, get_path_from_icon_name("late", 16));
+
+        // Misses are remembered
+        ASSERT(g_file_set_contents(file, "", 0, NULL));
+        ASSERT_EQ(NULL, get_path_from_icon_name("late", 16));
+
+        icon_path_cache_clear();
+        char *result = get_path_from_icon_name("late", 16);
+        ASSERT_STR_EQ(file, result);
+        g_free(result);
+
+        // Hits are checked before they get returned
+        g_remove(file);
+        ASSERT_EQ(NULL, get_path_from_icon_name("late", 16));
+
+        icon_path_cache_clear();
+        settings.icon_path = old_icon_path;
+        settings.enable_recursive_icon_lookup = old_recursive;
+        g_rmdir(dir);
+        g_free(file);
+        g_free(dir);
+        PASS();
+}
+
+/* The conversion as it was done before it got rewritten with integers */
+static void reference_pixbuf_data_to_cairo_data(const unsigned char *pixels_p,
+                                                unsigned char *pixels_c,
+                                                size_t rowstride_p, size_t rowstride_c,
+                                                int width, int height, int n_channels)
+{
+        for (int h = 0; h < height; h++) {
+                uint32_t *iter_c = (uint32_t *) (pixels_c + h * rowstride_c);
+                const unsigned char *iter_p = pixels_p + h * rowstride_p;
+                for (int w = 0; w < width; w++, iter_p += n_channels) {
+                        double alpha_factor = n_channels == 3 ? 1 : iter_p[3] / (double)0xff;
+                        uint32_t a = n_channels == 3 ? 0xff : iter_p[3];
+                        iter_c[w] = a << 24
+                                  | (uint32_t)(unsigned char)(iter_p[0] * alpha_factor + .5) << 16
+                                  | (uint32_t)(unsigned char)(iter_p[1] * alpha_factor + .5) << 8
+                                  | (uint32_t)(unsigned char)(iter_p[2] * alpha_factor + .5);
+                }
+        }
+}
+
+/* Every combination of color and alpha, with padded rows */
+static unsigned char *test_pixbuf_data(int n_channels, size_t *rowstride)
+{
+        *rowstride = 256 * n_channels + 3;
+        unsigned char *pixels = g_malloc(*rowstride * 256);
+        for (int a = 0; a < 256; a++) {
+                unsigned char *p = pixels + a * *rowstride;
+                for (int c = 0; c < 256; c++, p += n_channels) {
+                        p[0] = c;
+                        p[1] = 255 - c;
+                        p[2] = c ^ 0x55;
+                        if (n_channels == 4)
+                                p[3] = a;
+                }
+                memset(p, 0xaa, 3);
+        }
+        return pixels;
+}
+
+TEST test_pixbuf_data_to_cairo_data_exact(int n_channels)
+{
+        size_t rowstride_p;
+        unsigned char *pixels = test_pixbuf_data(n_channels, &rowstride_p);
+        size_t rowstride_c = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, 256);
+        unsigned char *expected = g_malloc0(rowstride_c * 256);
+        unsigned char *actual = g_malloc0(rowstride_c * 256);
+
+        reference_pixbuf_data_to_cairo_data(pixels, expected, rowstride_p, rowstride_c, 256, 256, n_channels);
+        pixbuf_data_to_cairo_data(pixels, actual, rowstride_p, rowstride_c, 256, 256, n_channels);
+        ASSERT_MEM_EQ(expected, actual, rowstride_c * 256);
+
+        g_free(pixels);
+        g_free(expected);
+        g_free(actual);
+        PASS();
+}
+
+/* Every kernel the CPU supports, including the tails of short rows */
+TEST test_pixel_kernels_exact(int n_channels)
+{
+        size_t rowstride_p;
+        unsigned char *pixels = test_pixbuf_data(n_channels, &rowstride_p);
+        uint32_t expected[256];
+        uint32_t actual[256];
+
+        for (size_t k = 0; k < G_N_ELEMENTS(pixel_kernels); k++) {
+                const struct pixel_kernel *kernel = &pixel_kernels[k];
+                if (!pixel_kernel_supported(kernel))
+                        continue;
+
+                void (*row)(const unsigned char *, uint32_t *, int) = n_channels == 3 ? kernel->rgb
+                                                                                      : kernel->rgba;
+                for (int h = 0; h < 256; h++) {
+                        // Vary the width, so every kernel has to finish a tail
+                        int width = 256 - h % 41;
+                        const unsigned char *p = pixels + h * rowstride_p;
+                        reference_pixbuf_data_to_cairo_data(p, (unsigned char *) expected,
+                                                            0, 0, width, 1, n_channels);
+                        row(p, actual, width);
+                        ASSERT_MEM_EQm(kernel->name, expected, actual, width * sizeof(uint32_t));
+                }
+        }
+
+        g_free(pixels);
+        PASS();
+}
+
+// TODO move this out of the test suite, since this isn't a real test
+TEST test_bench_pixbuf_data_to_cairo_data(int n_channels)
+{
+        size_t rowstride_p;
+        unsigned char *pixels = test_pixbuf_data(n_channels, &rowstride_p);
+        size_t rowstride_c = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, 256);
+        unsigned char *out = g_malloc(rowstride_c * 256);
+
+        printf("Benchmarking conversion of %d channels\n", n_channels);
+        clock_t start_time;
+        double elapsed_time;
+        for (size_t k = 0; k < G_N_ELEMENTS(pixel_kernels); k++) {
+                const struct pixel_kernel *kernel = &pixel_kernels[k];
+                if (!pixel_kernel_supported(kernel))
+                        continue;
+
+                start_time = clock();
+                for (int i = 0; i < 1000; i++)
+                        for (int h = 0; h < 256; h++)
+                                (n_channels == 3 ? kernel->rgb : kernel->rgba)(pixels + h * rowstride_p,
+                                        (uint32_t *) (out + h * rowstride_c), 256);
+                elapsed_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+                printf("%s done in %f seconds\n", kernel->name, elapsed_time);
+        }
+
+        start_time = clock();
+        for (int i = 0; i < 1000; i++)
+                reference_pixbuf_data_to_cairo_data(pixels, out, rowstride_p, rowstride_c, 256, 256, n_channels);
+        elapsed_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+        printf("Reference done in %f seconds\n", elapsed_time);
+
+        g_free(pixels);
+        g_free(out);
+        PASS();
+}
+
+static GVariant *test_icon_data(int width, int height, int rowstride, const guint8 *pixels)
+{
+        gsize len = (height - 1) * rowstride + width * 4;
+        GVariant *data = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, pixels, len, 1);
+        return g_variant_ref_sink(g_variant_new("(iiibii@ay)",
+                                                width, height, rowstride,
+                                                TRUE, 8, 4, data));
+}
+
+TEST test_icon_surface_from_data_downscaled(void)
+{
+        // 4x2 RGBA with a padding of two bytes per row
+        const guint8 pixels[] = {
+                0xff, 0x00, 0x00, 0xff,  0xff, 0x00, 0x00, 0xff,
+                0x00, 0x00, 0xff, 0x00,  0x00, 0x00, 0xff, 0x00,  0xaa, 0xaa,
+                0xff, 0x00, 0x00, 0xff,  0xff, 0x00, 0x00, 0xff,
+                0x00, 0x00, 0xff, 0x00,  0x00, 0x00, 0xff, 0x00,
+        };
+        // The padding is not part of the image
+        guint8 padded[sizeof(pixels)];
+        memcpy(padded, pixels, sizeof(pixels));
+        padded[16] = padded[17] = 0x55;
+
+        GVariant *data = test_icon_data(4, 2, 18, pixels);
+        GVariant *other = test_icon_data(4, 2, 18, padded);
+        char *id = NULL, *other_id = NULL;
+
+        icon_cache_clear();
+        cairo_surface_t *s = icon_surface_from_data(data, &id, 1, 0, 2);
+        ASSERT(s);
+        ASSERT(id);
+        ASSERT_EQ(2, cairo_image_surface_get_width(s));
+        ASSERT_EQ(1, cairo_image_surface_get_height(s));
+
+        // Opaque red on the left, transparent on the right, premultiplied
+        const uint32_t *px = (const uint32_t *) cairo_image_surface_get_data(s);
+        ASSERT_EQ_FMT(0xffff0000, px[0], "%08x");
+        ASSERT_EQ_FMT(0x00000000, px[1], "%08x");
+
+        cairo_surface_t *s2 = icon_surface_from_data(other, &other_id, 1, 0, 2);
+        ASSERT_EQ(s, s2);
+        ASSERT_STR_EQ(id, other_id);
+
+        cairo_surface_destroy(s);
+        cairo_surface_destroy(s2);
+        g_free(id);
+        g_free(other_id);
+        g_variant_unref(data);
+        g_variant_unref(other);
+        icon_cache_clear();
+        PASS();
+}
+
+TEST test_icon_cache_file(void)
+{
+        int budget = settings.icon_cache_size;
+        char *path = g_build_filename(base, DATAPREFIX, "icons", "valid.png", NULL);
+        char *id1 = NULL, *id2 = NULL;
+        struct icon_cache_stats before, after;
+
+        settings.icon_cache_size = 1024;
+        icon_cache_clear();
+        icon_cache_get_stats(&before);
+
+        cairo_surface_t *s1 = icon_surface_from_file(path, &id1, 0, 0, 1);
+        cairo_surface_t *s2 = icon_surface_from_file(path, &id2, 0, 0, 1);
+        ASSERT(s1);
+        ASSERT_EQ(s1, s2);
+        ASSERT_STR_EQ(id1, id2);
+
+        icon_cache_get_stats(&after);
+        ASSERT_EQ(before.misses + 1, after.misses);
+        ASSERT_EQ(before.hits + 1, after.hits);
+        ASSERT_EQ(1, after.entries);
+
+        // A different size is a different entry
+        g_clear_pointer(&id2, g_free);
+        cairo_surface_t *s3 = icon_surface_from_file(path, &id2, 0, 2, 1);
+        ASSERT(s3 != s1);
+        ASSERT_EQ(2, get_icon_width(s3, 1));
+        cairo_surface_destroy(s3);
+
+        // Cached surfaces stay valid for their users when dropped
+        icon_cache_clear();
+        icon_cache_get_stats(&after);
+        ASSERT_EQ(0, after.entries);
+        ASSERT_EQ(0, after.size);
+        ASSERT_EQ(4, get_icon_width(s1, 1));
+
+        cairo_surface_destroy(s1);
+        cairo_surface_destroy(s2);
+
+        settings.icon_cache_size = 0;
+        g_clear_pointer(&id1, g_free);
+        g_clear_pointer(&id2, g_free);
+        s1 = icon_surface_from_file(path, &id1, 0, 0, 1);
+        s2 = icon_surface_from_file(path, &id2, 0, 0, 1);
+        ASSERT(s1 != s2);
+        icon_cache_get_stats(&after);
+        ASSERT_EQ(0, after.entries);
+        cairo_surface_destroy(s1);
+        cairo_surface_destroy(s2);
+
+        settings.icon_cache_size = budget;
+        g_free(id1);
+        g_free(id2);
+        g_free(path);
+        PASS();
+}
+
 SUITE(suite_icon)
 {
         // set only valid icons in the path
@@ -90,6 +415,7 @@ SUITE(suite_icon)
         printf("Icon path: %s\n", icon_path);
         RUN_TEST(test_get_path_from_icon_null);
         RUN_TEST(test_get_path_from_icon_name_full);
+        RUN_TEST(test_get_path_from_icon_name_cached);
         RUN_TESTp(test_icon_size_clamp_not_necessary, 0, 100);
 
         RUN_TESTp(test_icon_size_clamp_too_small, 16, 100);
@@ -103,5 +429,20 @@ SUITE(suite_icon)
         RUN_TESTp(test_icon_size_clamp_not_necessary, 0, 100);
         RUN_TESTp(test_icon_size_clamp_too_big, 0, 100);
 
+        RUN_TEST(test_icon_cache_file);
+        RUN_TEST(test_icon_cache_peek_uncounted);
+        RUN_TEST(test_get_pixbuf_from_file_truncated);
+        RUN_TEST(test_icon_surface_from_data_downscaled);
+        RUN_TESTp(test_pixbuf_data_to_cairo_data_exact, 3);
+        RUN_TESTp(test_pixbuf_data_to_cairo_data_exact, 4);
+        RUN_TESTp(test_pixel_kernels_exact, 3);
+        RUN_TESTp(test_pixel_kernels_exact, 4);
+
+        bool bench = false;
+        if (bench) {
+                RUN_TESTp(test_bench_pixbuf_data_to_cairo_data, 3);
+                RUN_TESTp(test_bench_pixbuf_data_to_cairo_data, 4);
+        }
+
         g_clear_pointer(&icon_path, g_free);
 }
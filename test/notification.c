@@ -219,6 +219,70 @@ TEST test_notification_icon_scaling_notneeded(void)
         PASS();
 }
 
+TEST test_notification_icon_load_path(void)
+{
+        char *path = g_strconcat(base, "/data/icons/valid.png", NULL);
+        struct notification *n = notification_create();
+        struct notification *other = notification_create();
+        n->min_icon_size = other->min_icon_size = 0;
+        n->max_icon_size = other->max_icon_size = 0;
+
+        icon_cache_clear();
+        notification_icon_load_path(n, path);
+        notification_icon_load_path(other, path);
+        ASSERT(n->icon_load);
+        ASSERT(other->icon_load);
+
+        // A replacement takes precedence over the pending load
+        notification_icon_replace_path(other, "");
+        ASSERT_FALSE(other->icon_load);
+
+        gint64 deadline = time_monotonic_now() + S2US(5);
+        while (n->icon_load && time_monotonic_now() < deadline)
+                g_main_context_iteration(NULL, FALSE);
+
+        ASSERT_FALSE(n->icon_load);
+        ASSERT(n->icon);
+        ASSERT(n->icon_id);
+        ASSERT_EQ(4, get_icon_width(n->icon, 1));
+        ASSERT_FALSE(other->icon);
+
+        // The decoded icon is cached now
+        notification_icon_load_path(other, path);
+        ASSERT_FALSE(other->icon_load);
+        ASSERT_EQ(n->icon, other->icon);
+        ASSERT_STR_EQ(n->icon_id, other->icon_id);
+
+        notification_unref(n);
+        notification_unref(other);
+        icon_cache_clear();
+        g_free(path);
+        PASS();
+}
+
+TEST test_notification_icon_load_teardown(void)
+{
+        char *path = g_strconcat(base, "/data/icons/valid.png", NULL);
+        struct notification *n = notification_create();
+        n->min_icon_size = 0;
+        n->max_icon_size = 0;
+
+        icon_cache_clear();
+        notification_icon_load_path(n, path);
+        ASSERT(n->icon_load);
+        ASSERT_EQ(2, notification_refcount_get(n));
+
+        // The pending load gets released without reaching the main loop
+        icon_loader_teardown();
+        ASSERT_FALSE(n->icon_load);
+        ASSERT_EQ(1, notification_refcount_get(n));
+
+        notification_unref(n);
+        icon_cache_clear();
+        g_free(path);
+        PASS();
+}
+
 TEST test_notification_format_message(struct notification *n, const char *format, const char *exp)
 {
         notification_replace_format(n, format);
@@ -264,6 +328,8 @@ SUITE(suite_notification)
         RUN_TEST(test_notification_icon_scaling_toolarge);
         RUN_TEST(test_notification_icon_scaling_notconfigured);
         RUN_TEST(test_notification_icon_scaling_notneeded);
+        RUN_TEST(test_notification_icon_load_path);
+        RUN_TEST(test_notification_icon_load_teardown);
 
         // TEST notification_format_message
         struct notification *a = notification_create();
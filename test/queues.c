@@ -6,6 +6,11 @@
 #include "greatest.h"
 #include "queues.h"
 #include "helpers.h"
+#include "icon.h"
+
+#include <glib/gstdio.h>
+
+extern const char *base;
 
 struct notification *queues_debug_find_notification_by_id(gint id)
 {
@@ -417,6 +422,81 @@ TEST test_queue_history_remove_by_id(void)
         PASS();
 }
 
+static char *history_log_test_open(void)
+{
+        char *dir = g_dir_make_tmp("dunst-queues-XXXXXX", NULL);
+        char *path = g_build_filename(dir, "history.log", NULL);
+        g_free(dir);
+        history_log_open(path);
+        return path;
+}
+
+static void history_log_test_remove(char *path)
+{
+        history_log_close();
+        char *dir = g_path_get_dirname(path);
+        g_remove(path);
+        g_rmdir(dir);
+        g_free(dir);
+        g_free(path);
+}
+
+TEST test_queue_history_log_unlimited(void)
+{
+        settings.history_length = 0;
+        char *path = history_log_test_open();
+        ASSERT(history_log_is_open());
+        queues_init();
+
+        struct notification *n = test_notification("n", -1);
+        queues_notification_insert(n, STATUS_NORMAL);
+        queues_notification_close(n, REASON_UNDEF);
+
+        // Every round adds a remove and an add record for a single entry
+        for (int i = 0; i < 200; i++) {
+                queues_history_pop();
+                QUEUE_LEN_ALL(0, 1, 0);
+                queues_notification_close(n, REASON_UNDEF);
+                QUEUE_LEN_ALL(0, 0, 1);
+                ASSERT(history_log_records() <= 2 + HISTORY_LOG_SLACK);
+        }
+
+        queues_teardown();
+        history_log_test_remove(path);
+        PASS();
+}
+
+TEST test_queue_history_restore_icon(void)
+{
+        char *icon = g_strconcat(base, "/data/icons/valid.png", NULL);
+        settings.history_length = 0;
+        char *path = history_log_test_open();
+        ASSERT(history_log_is_open());
+
+        struct notification *n = test_notification("n", -1);
+        g_free(n->iconname);
+        n->iconname = g_strdup(icon);
+        history_log_append(n);
+        notification_unref(n);
+        history_log_close();
+
+        ASSERT(history_log_open(path));
+        queues_init();
+        ASSERT_EQ(1, queues_length_history());
+        queues_history_pop();
+        QUEUE_LEN_ALL(0, 1, 0);
+
+        n = g_queue_peek_head(waiting);
+        ASSERT_STR_EQ(icon, n->iconname);
+        ASSERT(n->icon || n->icon_load);
+
+        icon_loader_teardown();
+        queues_teardown();
+        history_log_test_remove(path);
+        g_free(icon);
+        PASS();
+}
+
 TEST test_queue_init(void)
 {
         queues_init();
@@ -626,6 +706,42 @@ TEST test_queue_stacking(void)
         PASS();
 }
 
+TEST test_queue_stacking_among_many(void)
+{
+        settings.stack_duplicates = true;
+        struct notification *n, *dup = NULL;
+
+        queues_init();
+
+        for (int i = 0; i < 20; i++) {
+                char name[16];
+                snprintf(name, sizeof(name), "n%d", i);
+                n = test_notification(name, -1);
+                if (i % 2) {
+                        g_free(n->appname);
+                        n->appname = g_strdup("many");
+                        n->stack_tag = g_strdup("odd");
+                }
+                queues_notification_insert(n, STATUS_NORMAL);
+                if (i == 12)
+                        dup = n;
+        }
+
+        // All odd ones got stacked into a single one
+        QUEUE_LEN_ALL(11, 0, 0);
+
+        // Only the duplicate of n12 is stacked, nothing else matches
+        notification_ref(dup);
+        n = test_notification("n12", -1);
+        queues_notification_insert(n, STATUS_NORMAL);
+        QUEUE_LEN_ALL(11, 0, 0);
+        ASSERT_EQ(1, n->dup_count);
+        NOT_LAST(dup);
+
+        queues_teardown();
+        PASS();
+}
+
 TEST test_queue_stacktag(void)
 {
         const char *stacktag = "THIS IS A SUPER WIERD STACK TAG";
@@ -1128,6 +1244,105 @@ TEST test_queues_timeout_before_paused(void)
         PASS();
 }
 
+TEST test_queues_update_due(void)
+{
+        struct notification *n1, *n2, *n3;
+        gint64 cur_time = S2US(100);
+        settings.show_age_threshold = -1;
+        queues_init();
+
+        n1 = test_notification("n1", 10);
+        n2 = test_notification("n2", 20);
+        n3 = test_notification("n3", 0);
+        queues_notification_insert(n1, STATUS_NORMAL);
+        queues_notification_insert(n2, STATUS_NORMAL);
+        queues_notification_insert(n3, STATUS_NORMAL);
+        queues_update(STATUS_NORMAL, cur_time);
+        QUEUE_LEN_ALL(0,3,0);
+        ASSERT_EQ(cur_time + S2US(10), queues_get_next_datachange(cur_time));
+
+        // Only the due notification gets checked, right at its timeout
+        n2->start -= S2US(100);
+        queues_update(STATUS_NORMAL, cur_time + S2US(10));
+        QUEUE_LEN_ALL(0,2,1);
+        QUEUE_CONTAINS(HIST, n1);
+        QUEUE_CONTAINS(DISP, n2);
+
+        queues_check_all();
+        queues_update(STATUS_NORMAL, cur_time + S2US(12));
+        QUEUE_LEN_ALL(0,1,2);
+        QUEUE_CONTAINS(DISP, n3);
+        ASSERT(queues_get_next_datachange(cur_time + S2US(12)) < 0);
+
+        queues_teardown();
+        PASS();
+}
+
+TEST test_queues_update_due_locked(void)
+{
+        struct notification *n1, *n2;
+        gint64 cur_time = S2US(100);
+        settings.show_age_threshold = -1;
+        queues_init();
+
+        n1 = test_notification("n1", 10);
+        n2 = test_notification("n2", 20);
+
+        queues_notification_insert(n1, STATUS_NORMAL);
+        queues_notification_insert(n2, STATUS_NORMAL);
+        queues_update(STATUS_NORMAL, cur_time);
+
+        // A locked notification doesn't time out
+        notification_lock(n1);
+        ASSERT_EQ(cur_time + S2US(20), queues_get_next_datachange(cur_time + S2US(11)));
+        queues_update(STATUS_NORMAL, cur_time + S2US(11));
+        QUEUE_LEN_ALL(0,2,0);
+
+        notification_unlock(n1);
+        ASSERT_EQ(cur_time + S2US(11), queues_get_next_datachange(cur_time + S2US(11)));
+        queues_update(STATUS_NORMAL, cur_time + S2US(11));
+        QUEUE_LEN_ALL(0,1,1);
+        QUEUE_CONTAINS(HIST, n1);
+
+        queues_teardown();
+        PASS();
+}
+
+TEST test_queues_generation(void)
+{
+        struct notification *n;
+        gint64 cur_time = S2US(100);
+        settings.show_age_threshold = S2US(5);
+        queues_init();
+
+        guint generation = queues_generation(cur_time);
+        ASSERT_EQ(generation, queues_generation(cur_time));
+
+        n = test_notification("n", 10);
+        n->timestamp = cur_time;
+        queues_notification_insert(n, STATUS_NORMAL);
+        ASSERT(generation != queues_generation(cur_time));
+
+        queues_update(STATUS_NORMAL, cur_time);
+        generation = queues_generation(cur_time);
+
+        // Nothing visible changes before the age gets shown
+        queues_update(STATUS_NORMAL, cur_time + S2US(2));
+        ASSERT_EQ(generation, queues_generation(cur_time + S2US(2)));
+
+        // The age changes every second once it is shown
+        generation = queues_generation(cur_time + S2US(5));
+        ASSERT_EQ(generation, queues_generation(cur_time + S2US(5) + 10));
+        ASSERT(generation != queues_generation(cur_time + S2US(6)));
+
+        generation = queues_generation(cur_time + S2US(6));
+        queues_update(STATUS_NORMAL, cur_time + S2US(11));
+        ASSERT(generation != queues_generation(cur_time + S2US(6)));
+
+        queues_teardown();
+        PASS();
+}
+
 TEST test_queue_find_by_id(void)
 {
         struct notification *n;
@@ -1151,6 +1366,100 @@ TEST test_queue_find_by_id(void)
         PASS();
 }
 
+TEST test_queue_find_by_id_moved(void)
+{
+        struct notification *a, *b;
+        gint id;
+        settings.history_length = 0;
+        queues_init();
+
+        a = test_notification("a", 0);
+        queues_notification_insert(a, STATUS_NORMAL);
+        id = a->id;
+        ASSERT_EQ(a, queues_get_by_id(id));
+
+        queues_update(STATUS_NORMAL, time_monotonic_now());
+        QUEUE_CONTAINS(DISP, a);
+        ASSERT_EQ(a, queues_get_by_id(id));
+
+        queues_notification_close_id(id, REASON_UNDEF);
+        QUEUE_CONTAINS(HIST, a);
+        ASSERT_EQ(a, queues_get_by_id(id));
+
+        // A new notification replacing the closed one takes precedence
+        b = test_notification("b", 0);
+        b->id = id;
+        queues_notification_insert(b, STATUS_NORMAL);
+        QUEUE_LEN_ALL(1, 0, 1);
+        ASSERT_EQ(b, queues_get_by_id(id));
+
+        queues_history_pop_by_id(id);
+        QUEUE_LEN_ALL(2, 0, 0);
+        ASSERT(queues_history_remove_by_id(id) == false);
+
+        queues_notification_close_id(id, REASON_UNDEF);
+        queues_notification_close_id(id, REASON_UNDEF);
+        QUEUE_LEN_ALL(0, 0, 2);
+        ASSERT(queues_history_remove_by_id(id));
+        ASSERT(queues_history_remove_by_id(id));
+        ASSERT_EQ(NULL, queues_get_by_id(id));
+
+        queues_teardown();
+        PASS();
+}
+
+static struct notification *test_notification_with_icon_id(const char *name, const char *icon_id)
+{
+        struct notification *n = test_notification(name, 0);
+        cairo_surface_destroy(n->icon);
+        g_free(n->icon_id);
+        n->icon = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 8, 8);
+        n->icon_id = g_strdup(icon_id);
+        return n;
+}
+
+TEST test_queue_history_compact(void)
+{
+        struct notification *a, *b, *c;
+        settings.history_length = 0;
+        settings.history_compact = true;
+        queues_init();
+
+        a = test_notification_with_icon_id("a", "same");
+        b = test_notification_with_icon_id("b", "same");
+        c = test_notification_with_icon_id("c", "other");
+        a->text_to_render = g_strdup("a");
+
+        queues_notification_insert(a, STATUS_NORMAL);
+        queues_notification_insert(b, STATUS_NORMAL);
+        queues_notification_insert(c, STATUS_NORMAL);
+        queues_notification_close(a, REASON_UNDEF);
+        queues_notification_close(b, REASON_UNDEF);
+        queues_notification_close(c, REASON_UNDEF);
+        QUEUE_LEN_ALL(0, 0, 3);
+
+        ASSERT_EQ(NULL, a->text_to_render);
+        ASSERT_EQ(a->icon, b->icon);
+        ASSERT(a->icon != c->icon);
+        ASSERT_EQ(2, g_hash_table_size(history_icons));
+
+        // The shared icon survives the removal of the entry it came from
+        queues_history_remove_by_id(a->id);
+        ASSERT_EQ(2, g_hash_table_size(history_icons));
+        ASSERT_EQ(b->icon, g_hash_table_lookup(history_icons, "same"));
+
+        queues_history_remove_by_id(b->id);
+        ASSERT_EQ(1, g_hash_table_size(history_icons));
+
+        queues_history_pop();
+        QUEUE_LEN_ALL(1, 0, 0);
+        ASSERT(c->icon);
+
+        queues_teardown();
+        settings.history_compact = false;
+        PASS();
+}
+
 TEST test_queue_get_history(void)
 {
         struct notification *n;
@@ -1251,9 +1560,12 @@ SUITE(suite_queues)
         RUN_TEST(test_datachange_queues);
         RUN_TEST(test_datachange_ttl);
         RUN_TEST(test_queue_history_clear);
+        RUN_TEST(test_queue_history_compact);
         RUN_TEST(test_queue_history_overfull);
         RUN_TEST(test_queue_history_pushall);
         RUN_TEST(test_queue_history_remove_by_id);
+        RUN_TEST(test_queue_history_log_unlimited);
+        RUN_TEST(test_queue_history_restore_icon);
         RUN_TEST(test_queue_init);
         RUN_TEST(test_queue_insert_id_invalid);
         RUN_TEST(test_queue_insert_id_replacement);
@@ -1266,6 +1578,7 @@ SUITE(suite_queues)
         RUN_TEST(test_queue_notification_skip_display_redisplayed);
         RUN_TEST(test_queue_notification_skip_display_redisplayed_by_random_id);
         RUN_TEST(test_queue_stacking);
+        RUN_TEST(test_queue_stacking_among_many);
         RUN_TEST(test_queue_stacktag);
         RUN_TEST(test_queue_different_stacktag);
         RUN_TEST(test_queue_stacktag_different_appid);
@@ -1280,7 +1593,11 @@ SUITE(suite_queues)
         RUN_TEST(test_queues_update_seeping);
         RUN_TEST(test_queues_update_xmore);
         RUN_TEST(test_queues_timeout_before_paused);
+        RUN_TEST(test_queues_update_due);
+        RUN_TEST(test_queues_update_due_locked);
+        RUN_TEST(test_queues_generation);
         RUN_TEST(test_queue_find_by_id);
+        RUN_TEST(test_queue_find_by_id_moved);
         RUN_TEST(test_queue_no_sort_and_pause);
         RUN_TEST(test_queue_get_history);
 
@@ -1,6 +1,7 @@
 #include "../src/rules.c"
 
 #include "greatest.h"
+#include "helpers.h"
 #include <regex.h>
 
 extern const char *base;
@@ -79,6 +80,134 @@ TEST test_pattern_match(void) {
         PASS();
 }
 
+TEST test_rule_compiled_match(void)
+{
+        struct notification *n = test_notification("compiled", -1);
+        struct rule *r = rule_new("test_rule_compiled_match");
+        r->appname = g_strdup(settings.enable_regex || settings.enable_pcre ? "of comp" : "app of comp*");
+
+        rule_compile(r);
+        ASSERT(r->matchers);
+        ASSERT(rule_matches_notification(r, n));
+
+        // Replacing a filter recompiles it on the next match
+        char *old = r->appname;
+        r->appname = g_strdup("somethingelse");
+        g_free(old);
+        ASSERT_FALSE(rule_matches_notification(r, n));
+
+        // A filter rewritten at the same address gets recompiled as well
+        g_free(r->appname);
+        r->appname = g_strdup(n->appname);
+        ASSERT(rule_matches_notification(r, n));
+        r->appname[0] = 'x';
+        ASSERT_FALSE(rule_matches_notification(r, n));
+
+        rule_invalidate(r);
+        ASSERT_FALSE(r->matchers);
+        g_free(r->appname);
+        r->appname = g_strdup(n->appname);
+        ASSERT(rule_matches_notification(r, n));
+
+        // Invalid patterns never match
+        if (settings.enable_regex || settings.enable_pcre) {
+                g_free(r->summary);
+                r->summary = g_strdup("(");
+                rule_invalidate(r);
+                ASSERT_FALSE(rule_matches_notification(r, n));
+        }
+
+        rules = g_slist_remove(rules, r);
+        rule_free(r);
+        notification_unref(n);
+        PASS();
+}
+
+TEST test_rule_apply_all_order(void)
+{
+        GSList *store = rules;
+        rules = NULL;
+
+        struct rule *by_urgency = rule_new("by_urgency");
+        by_urgency->msg_urgency = URG_NORM;
+        by_urgency->timeout = 1;
+
+        struct rule *by_app = rule_new("by_app");
+        by_app->appname = g_strdup("app of ordered");
+        by_app->set_category = g_strdup("ordered");
+        by_app->timeout = 2;
+
+        struct rule *other_app = rule_new("other_app");
+        other_app->appname = g_strdup("another app");
+        other_app->set_stack_tag = g_strdup("wrong");
+
+        // Only matches after by_app set the category
+        struct rule *by_category = rule_new("by_category");
+        by_category->category = g_strdup("ordered");
+        by_category->timeout = 3;
+
+        struct rule *residual = rule_new("residual");
+        residual->summary = g_strdup(settings.enable_regex || settings.enable_pcre ? "order" : "order*");
+        residual->urgency = URG_CRIT;
+
+        // Matches the urgency set by the residual rule, but comes before it
+        struct rule *too_early = rule_new("too_early");
+        too_early->msg_urgency = URG_CRIT;
+        too_early->timeout = 4;
+        rules = g_slist_remove(rules, too_early);
+        rules = g_slist_prepend(rules, too_early);
+
+        struct notification *n = test_notification("ordered", -1);
+
+        ASSERT_EQ(3, n->timeout);
+        ASSERT_STR_EQ("ordered", n->category);
+        ASSERT_EQ(URG_CRIT, n->urgency);
+        ASSERT_EQ(NULL, n->stack_tag);
+
+        notification_unref(n);
+        g_slist_free_full(rules, (GDestroyNotify)rule_free);
+        rules = store;
+        PASS();
+}
+
+TEST test_rule_apply_all_list_changed(void)
+{
+        GSList *store = rules;
+        rules = NULL;
+
+        struct rule *kept = rule_new("kept");
+        kept->appname = g_strdup("app of changed");
+        kept->set_category = g_strdup("kept");
+
+        struct rule *removed = rule_new("removed");
+        removed->appname = g_strdup("app of changed");
+        removed->set_stack_tag = g_strdup("removed");
+
+        struct notification *n = test_notification("changed", -1);
+        ASSERT_STR_EQ("kept", n->category);
+        ASSERT_STR_EQ("removed", n->stack_tag);
+        notification_unref(n);
+
+        // Changes to the list take effect without telling anybody
+        rules = g_slist_remove(rules, removed);
+        n = test_notification("changed", -1);
+        ASSERT_STR_EQ("kept", n->category);
+        ASSERT_EQ(NULL, n->stack_tag);
+        notification_unref(n);
+
+        rules = g_slist_append(rules, removed);
+        rules = g_slist_remove(rules, kept);
+        rule_free(kept);
+        n = test_notification("changed", -1);
+        ASSERT_EQ(NULL, n->category);
+        ASSERT_STR_EQ("removed", n->stack_tag);
+        notification_unref(n);
+
+        g_slist_free_full(rules, (GDestroyNotify)rule_free);
+        rules = store;
+        PASS();
+}
+
 SUITE(suite_rules) {
         bool store = settings.enable_regex;
 
@@ -87,12 +216,18 @@ SUITE(suite_rules) {
          */
         settings.enable_regex = false;
         RUN_TEST(test_pattern_match);
+        RUN_TEST(test_rule_compiled_match);
+        RUN_TEST(test_rule_apply_all_order);
+        RUN_TEST(test_rule_apply_all_list_changed);
 
         /*
          * Test Posix regex
          */
         settings.enable_regex = true;
         RUN_TEST(test_pattern_match);
+        RUN_TEST(test_rule_compiled_match);
+        RUN_TEST(test_rule_apply_all_order);
+        RUN_TEST(test_rule_apply_all_list_changed);
 
         settings.enable_regex = store;
 
@@ -103,6 +238,9 @@ SUITE(suite_rules) {
 
         settings.enable_pcre = true;
         RUN_TEST(test_pattern_match);
+        RUN_TEST(test_rule_compiled_match);
+        RUN_TEST(test_rule_apply_all_order);
+        RUN_TEST(test_rule_apply_all_list_changed);
 
         settings.enable_pcre = store;
 }
@@ -0,0 +1,104 @@
+#include "../src/script.c"
+#include "greatest.h"
+
+#include "helpers.h"
+
+TEST test_script_get_envp(void)
+{
+        struct notification *n = test_notification("env", 10);
+        n->id = 42;
+        n->progress = 50;
+        n->urgency = URG_CRIT;
+
+        char **envp = script_get_envp(n);
+        ASSERT_STR_EQ("env", g_environ_getenv(envp, "DUNST_SUMMARY"));
+        ASSERT_STR_EQ("app of env", g_environ_getenv(envp, "DUNST_APP_NAME"));
+        ASSERT_STR_EQ("42", g_environ_getenv(envp, "DUNST_ID"));
+        ASSERT_STR_EQ("50", g_environ_getenv(envp, "DUNST_PROGRESS"));
+        ASSERT_STR_EQ("CRITICAL", g_environ_getenv(envp, "DUNST_URGENCY"));
+        ASSERT_STR_EQ("", g_environ_getenv(envp, "DUNST_STACK_TAG"));
+
+        // The environment of dunst gets passed on
+        if (g_getenv("PATH"))
+                ASSERT_STR_EQ(g_getenv("PATH"), g_environ_getenv(envp, "PATH"));
+
+        g_strfreev(envp);
+        notification_unref(n);
+        script_teardown();
+        PASS();
+}
+
+TEST test_script_get_record(void)
+{
+        struct notification *n = test_notification("record", 10);
+        n->id = 7;
+        g_free(n->body);
+        n->body = g_strdup("say \"hi\"\n\\o/\x01");
+
+        char *record = script_get_record(n);
+        ASSERT(g_str_has_prefix(record, "{\"DUNST_APP_NAME\":\"app of record\",\"DUNST_SUMMARY\":\"record\","));
+        ASSERT(strstr(record, ",\"DUNST_BODY\":\"say \\\"hi\\\"\\n\\\\o/\\u0001\","));
+        ASSERT(strstr(record, ",\"DUNST_ID\":\"7\","));
+        ASSERT(g_str_has_suffix(record, "}\n"));
+
+        // A record is a single line
+        ASSERT_EQ(strchr(record, '\n'), record + strlen(record) - 1);
+
+        g_free(record);
+        notification_unref(n);
+        PASS();
+}
+
+TEST test_script_run_limits(void)
+{
+        int rate_limit = settings.script_rate_limit;
+        int queue_size = settings.script_queue_size;
+        settings.script_rate_limit = 1;
+        settings.script_queue_size = 2;
+
+        const char *script = "dunst-test-script-that-does-not-exist";
+        struct notification *n[4];
+        for (int i = 0; i < 4; i++) {
+                n[i] = test_notification("script", 10);
+                n[i]->id = i + 1;
+        }
+
+        // The first run gets started (and fails), the others are rate limited
+        script_run(script, n[0]);
+        ASSERT_EQ(0, script_queue_length());
+        ASSERT_EQ(0, script_running());
+
+        script_run(script, n[1]);
+        ASSERT_EQ(1, script_queue_length());
+
+        // Runs for the same notification get coalesced
+        g_free(n[1]->summary);
+        n[1]->summary = g_strdup("updated");
+        script_run(script, n[1]);
+        ASSERT_EQ(1, script_queue_length());
+        struct script_job *job = g_queue_peek_head(&scripts.waiting);
+        ASSERT_STR_EQ("updated", job->argv[2]);
+
+        // The oldest run gets dropped when the queue is full
+        script_run(script, n[2]);
+        script_run(script, n[3]);
+        ASSERT_EQ(2, script_queue_length());
+        job = g_queue_peek_head(&scripts.waiting);
+        ASSERT_EQ(3, job->id);
+
+        script_teardown();
+        ASSERT_EQ(0, script_queue_length());
+
+        for (int i = 0; i < 4; i++)
+                notification_unref(n[i]);
+        settings.script_rate_limit = rate_limit;
+        settings.script_queue_size = queue_size;
+        PASS();
+}
+
+SUITE(suite_script)
+{
+        RUN_TEST(test_script_get_envp);
+        RUN_TEST(test_script_get_record);
+        RUN_TEST(test_script_run_limits);
+}
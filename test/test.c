@@ -19,6 +19,7 @@ SUITE_EXTERN(suite_markup);
 SUITE_EXTERN(suite_misc);
 SUITE_EXTERN(suite_icon);
 SUITE_EXTERN(suite_queues);
+SUITE_EXTERN(suite_history_log);
 SUITE_EXTERN(suite_dunst);
 SUITE_EXTERN(suite_log);
 SUITE_EXTERN(suite_menu);
@@ -29,6 +30,7 @@ SUITE_EXTERN(suite_icon_lookup);
 SUITE_EXTERN(suite_draw);
 SUITE_EXTERN(suite_rules);
 SUITE_EXTERN(suite_input);
+SUITE_EXTERN(suite_script);
 
 GREATEST_MAIN_DEFS();
 
@@ -55,6 +57,7 @@ int main(int argc, char *argv[]) {
         RUN_SUITE(suite_misc);
         RUN_SUITE(suite_icon);
         RUN_SUITE(suite_queues);
+        RUN_SUITE(suite_history_log);
         RUN_SUITE(suite_dunst);
         RUN_SUITE(suite_log);
         RUN_SUITE(suite_menu);
@@ -65,6 +68,7 @@ int main(int argc, char *argv[]) {
         RUN_SUITE(suite_draw);
         RUN_SUITE(suite_rules);
         RUN_SUITE(suite_input);
+        RUN_SUITE(suite_script);
 
         settings_free(&settings);
         g_strfreev(configs);